@@ -27,13 +27,26 @@
 #include <string>
 #include <algorithm>
 #include <fstream>
-#include <regex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <iterator>
+#include <numeric>
+#include <set>
 #include <rapidjson/document.h>
+#include <rapidjson/reader.h>
+#include <rapidjson/memorystream.h>
+#include <rapidjson/writer.h>
 #include <rapidjson/error/en.h>
 #include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
 #include "asar.h"
+#include "workpool.h"
+#include "sha256.h"
+#include "uring.h"
+#include "tar.h"
 
 #ifdef _WIN32
 # include <direct.h>
@@ -49,511 +62,4427 @@
 # include <endian.h>
 #endif
 # include <sys/stat.h>
+# include <sys/mman.h>
+# include <fcntl.h>
 # include <unistd.h>
+#ifdef __linux__
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+#endif
 # define _mkdir(a) mkdir(a,0777)
 # define DIR_SEPARATORS      "/"
 # define IS_DIR_SEPARATOR(x) (x=='/')
 #endif // _WIN32
 
-#define BUFF_SIZE (512*1024)
+#define BUFF_SIZE (512*1024)
+
+// extraction planner: files of up to COALESCE_MAX_FILE bytes whose data
+// is at most COALESCE_GAP bytes apart are read together, and the kernel
+// is asked to read the archive READAHEAD_WINDOW bytes ahead
+#define COALESCE_MAX_FILE (64*1024)
+#define COALESCE_GAP (4*1024)
+#define READAHEAD_WINDOW (32*1024*1024)
+
+// block size of the integrity hashes, same as upstream asar
+#define INTEGRITY_BLOCK_SIZE (4*1024*1024)
+
+// smallest chunk of the pool allocator of loadHeader()
+#define HEADER_POOL_MIN (64*1024)
+
+// io_uring extraction: files in flight (each takes up to 3 submission
+// slots) and the largest file written through the ring, bigger ones are
+// left to copyData() which may turn them into reflinks
+#define URING_FILES 128
+#define URING_MAX_FILE (1024*1024)
+
+// directory descriptors each extraction worker keeps open
+#define DIRFD_CACHE 16
+
+// pack from tar: data of up to this many bytes is staged in memory,
+// the rest in a temporary file
+#define TAR_STAGING_MEMORY (64*1024*1024)
+
+// sidecar index files, see setIndex()
+#define INDEX_MAGIC "asaridx1"
+#define INDEX_BYTE_ORDER 0x01020304
+
+
+// stats of the operation running on this thread, the system calls
+// made here are counted there (none if NULL)
+static thread_local asarArchive::stats_t *t_pStats = NULL;
+
+// sets t_pStats for the lifetime of the object
+class statsScope {
+
+public:
+	explicit statsScope( asarArchive::stats_t &stats ) : m_pPrev(t_pStats) { t_pStats = &stats; }
+	~statsScope() { t_pStats = m_pPrev; }
+
+private:
+	asarArchive::stats_t *m_pPrev;
+
+};
+
+static inline void countSyscall( asarArchive::syscall_t kind, uint64_t bytesRead = 0, uint64_t bytesWritten = 0 ) {
+	if ( t_pStats ) {
+		t_pStats->syscalls[kind].fetch_add( 1, std::memory_order_relaxed );
+		if ( bytesRead )
+			t_pStats->bytesRead.fetch_add( bytesRead, std::memory_order_relaxed );
+		if ( bytesWritten )
+			t_pStats->bytesWritten.fetch_add( bytesWritten, std::memory_order_relaxed );
+	}
+}
+
+
+#ifndef _WIN32
+// pread() exactly size bytes
+static bool preadAll( int fd, char *buf, size_t size, off_t offset ) {
+	while (size > 0) {
+		ssize_t n = ::pread(fd, buf, size, offset);
+		countSyscall( asarArchive::SYSCALL_READ, n > 0 ? n : 0 );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		buf += n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
+
+// pwrite() all of buf
+static bool pwriteAll( int fd, const char *buf, size_t size, off_t offset ) {
+	while (size > 0) {
+		ssize_t n = ::pwrite(fd, buf, size, offset);
+		countSyscall( asarArchive::SYSCALL_WRITE, 0, n > 0 ? n : 0 );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		buf += n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
+
+// write() all of buf, for pipes
+static bool writeAll( int fd, const char *buf, size_t size ) {
+	while (size > 0) {
+		ssize_t n = ::write(fd, buf, size);
+		countSyscall( asarArchive::SYSCALL_WRITE, 0, n > 0 ? n : 0 );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return false;
+		buf += n;
+		size -= n;
+	}
+	return true;
+}
+
+#ifdef __linux__
+// errors that mean "not possible here", as opposed to a real I/O error
+static bool isCopyUnsupported( int err ) {
+	return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == ENOTSUP;
+}
+#endif
+
+// Copy size bytes from inFd at inOffset to outFd at outOffset.
+// Kernel-side copies are tried first: copy_file_range() may become a
+// metadata-only reflink on btrfs/XFS and sendfile() at least skips the
+// round trip through user space. Otherwise the data is written from
+// pSrc (the same bytes in a memory mapping) if given, or copied through
+// buf (BUFF_SIZE bytes).
+// Returns the asarArchive::copyMethod_t that moved the data, -1 on error.
+static int copyData( int inFd, off_t inOffset, int outFd, off_t outOffset, uint64_t size, const char *pSrc, char *buf ) {
+	const uint64_t szTotal = size;
+	int method = asarArchive::COPY_MMAP;
+
+#ifdef __linux__
+	static std::atomic<bool> bNoCopyFileRange(false);
+	method = bNoCopyFileRange ? asarArchive::COPY_SENDFILE : asarArchive::COPY_FILE_RANGE;
+
+	while (size > 0 && method == asarArchive::COPY_FILE_RANGE) {
+		loff_t inOff = inOffset, outOff = outOffset;
+		ssize_t n = ::syscall(__NR_copy_file_range, inFd, &inOff, outFd, &outOff, std::min<uint64_t>(size, 0x40000000), 0);
+		countSyscall( asarArchive::SYSCALL_COPY, n > 0 ? n : 0, n > 0 ? n : 0 );
+
+		if ( n > 0 ) {
+			inOffset += n;
+			outOffset += n;
+			size -= n;
+		} else if ( n == 0 ) {
+			return -1;  // source is shorter than expected
+		} else if ( errno != EINTR ) {
+			if ( !isCopyUnsupported(errno) )
+				return -1;
+			if ( errno == ENOSYS )
+				bNoCopyFileRange = true;
+			method = asarArchive::COPY_SENDFILE;
+		}
+	}
+
+	if ( size > 0 && method == asarArchive::COPY_SENDFILE ) {
+		// sendfile() writes at the current file position
+		if ( ::lseek(outFd, outOffset, SEEK_SET) == -1 )
+			method = asarArchive::COPY_MMAP;
+
+		while (size > 0 && method == asarArchive::COPY_SENDFILE) {
+			off_t inOff = inOffset;
+			ssize_t n = ::sendfile(outFd, inFd, &inOff, std::min<uint64_t>(size, 0x40000000));
+			countSyscall( asarArchive::SYSCALL_COPY, n > 0 ? n : 0, n > 0 ? n : 0 );
+
+			if ( n > 0 ) {
+				inOffset += n;
+				outOffset += n;
+				size -= n;
+			} else if ( n == 0 ) {
+				return -1;
+			} else if ( errno != EINTR ) {
+				if ( !isCopyUnsupported(errno) )
+					return -1;
+				method = asarArchive::COPY_MMAP;
+			}
+		}
+	}
+#endif  // __linux__
+
+	if ( size > 0 && pSrc ) {
+		if ( !pwriteAll(outFd, pSrc + (szTotal - size), size, outOffset) )
+			return -1;
+		return asarArchive::COPY_MMAP;
+	}
+
+	if ( size > 0 )
+		method = asarArchive::COPY_BUFFERED;
+
+	while (size > 0) {
+		size_t szChunk = std::min<uint64_t>(size, BUFF_SIZE);
+
+		if ( !preadAll(inFd, buf, szChunk, inOffset) || !pwriteAll(outFd, buf, szChunk, outOffset) )
+			return -1;
+		inOffset += szChunk;
+		outOffset += szChunk;
+		size -= szChunk;
+	}
+
+	return method;
+}
+
+// Remove a range of a file from the page cache (size 0: to the end),
+// dirty pages are written back first as only clean ones can be dropped.
+static void dropCache( int fd, off_t offset, off_t size, bool bDirty ) {
+#ifdef POSIX_FADV_DONTNEED
+	if ( bDirty ) {
+#ifdef __linux__
+		::sync_file_range( fd, offset, size,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+#else
+		::fdatasync( fd );
+#endif
+		countSyscall( asarArchive::SYSCALL_CACHE );
+	}
+
+	::posix_fadvise( fd, offset, size, POSIX_FADV_DONTNEED );
+	countSyscall( asarArchive::SYSCALL_CACHE );
+#else
+	(void) fd; (void) offset; (void) size; (void) bDirty;
+#endif
+}
+#endif  // !_WIN32
+
+
+#ifndef _WIN32
+// an open directory, kept alive by the tasks of its subdirectories
+// so they can be opened relative to it
+struct asarArchive::scanDir_t {
+	DIR *dir;
+
+	explicit scanDir_t( DIR *d ) : dir(d) {}
+	~scanDir_t() { closedir(dir); countSyscall( asarArchive::SYSCALL_OPEN ); }
+
+	int fd() const { return dirfd(dir); }
+};
+#else
+struct asarArchive::scanDir_t {};
+#endif
+
+struct asarArchive::scanContext_t {
+	workPool *pool;
+	stats_t *stats;
+	const pathMatcher *unpack;
+	const pathMatcher *unpackDir;
+	size_t rootLen;  // globs match the path relative to the root
+	bool excludeHidden;
+	bool dedup;
+	std::atomic<bool> failed;
+
+	// hard linked files are hashed for deduplication only once
+	std::mutex inodeMutex;
+	std::set<std::pair<uint64_t, uint64_t>> setInodes;
+
+	bool claim( const scanNode_t &node ) {
+		if ( node.ino == 0 )
+			return true;
+		std::lock_guard<std::mutex> lock(inodeMutex);
+		return setInodes.emplace( node.dev, node.ino ).second;
+	}
+
+	bool matches( const pathMatcher *m, const std::string &sPath ) const {
+		if ( !m )
+			return false;
+		if ( m->isRegex() )
+			return m->match( sPath );
+		return m->match( sPath.c_str() + rootLen, sPath.size() - rootLen );
+	}
+};
+
+// Read the entries of one directory into node->children and queue
+// a task for every subdirectory.
+void asarArchive::scanDirectory( scanContext_t &ctx, unsigned worker, scanNode_t *node, std::shared_ptr<scanDir_t> parent ) {
+	if ( ctx.failed )
+		return;
+
+	statsScope scope( *ctx.stats );
+
+#ifdef _WIN32
+	DIR* dir = opendir( node->path.c_str() );
+	countSyscall( SYSCALL_DIR );
+	if ( !dir ) {
+		perror(node->path.c_str());
+		ctx.failed = true;
+		return;
+	}
+
+	struct dirent* file;
+	std::vector<std::string> entries;
+
+	while ( countSyscall( SYSCALL_DIR ), (file = readdir(dir)) ) {
+		const char *p = file->d_name;
+
+		// ignore "." and ".."
+		if ( p[0] == '.' && ( p[1] == 0 || (p[1] == '.' && p[2] == 0) ) )
+			continue;
+
+		entries.push_back(p);
+	}
+
+	closedir(dir);
+	std::sort(entries.begin(), entries.end());
+
+	for ( const auto &e : entries ) {
+		scanNode_t child;
+		child.name = e;
+		child.path = node->path + "/" + e;
+		child.size = 0;
+		child.hidden = false;
+		child.mtime = -1;
+
+		DWORD res = GetFileAttributesA(child.path.c_str());
+		countSyscall( SYSCALL_STAT );
+		if ( res != INVALID_FILE_ATTRIBUTES && (res & FILE_ATTRIBUTE_HIDDEN) )
+			child.hidden = true;
+
+		if (ctx.excludeHidden && child.hidden)
+			continue;
+
+		DIR* isDir = opendir( child.path.c_str() );
+		countSyscall( SYSCALL_DIR );
+
+		if ( isDir ) {
+			closedir( isDir );
+
+			if ( ctx.matches(ctx.unpackDir, child.path) )
+				continue;
+
+			child.type = 'D';
+			node->children.push_back( std::move(child) );
+			continue;
+		}
+
+		if ( ctx.matches(ctx.unpack, child.path) )
+			continue;
+
+		HANDLE hFile = CreateFile(child.path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL);
+		countSyscall( SYSCALL_OPEN );
+		if ( hFile == INVALID_HANDLE_VALUE ) {
+			std::cerr << "cannot open file for reading: " << child.path << std::endl;
+			ctx.failed = true;
+			return;
+		}
+
+		LARGE_INTEGER lFileSize;
+		BY_HANDLE_FILE_INFORMATION info;
+		BOOL ret = GetFileSizeEx(hFile, &lFileSize);
+
+		if ( ret && ctx.dedup && GetFileInformationByHandle(hFile, &info) && info.nNumberOfLinks > 1 ) {
+			child.dev = info.dwVolumeSerialNumber;
+			child.ino = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+		}
+		CloseHandle(hFile);
+
+		if ( ret == FALSE ) {
+			std::cerr << "cannot retrieve file size: " << child.path << std::endl;
+			ctx.failed = true;
+			return;
+		}
+
+		child.size = lFileSize.QuadPart;
+		child.type = 'F';
+		node->children.push_back( std::move(child) );
+	}
+
+	std::shared_ptr<scanDir_t> self;
+#else
+	// open relative to the parent, so the kernel doesn't
+	// have to resolve the whole path again
+	int fd = parent ? ::openat( parent->fd(), node->name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC )
+		: ::open( node->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	DIR *dir = (fd == -1) ? NULL : fdopendir(fd);
+	countSyscall( SYSCALL_OPEN );
+
+	if ( !dir ) {
+		perror(node->path.c_str());
+		if ( fd != -1 )
+			::close(fd);
+		ctx.failed = true;
+		return;
+	}
+
+	std::shared_ptr<scanDir_t> self = std::make_shared<scanDir_t>(dir);
+	struct dirent* file;
+	std::vector<std::pair<std::string, unsigned char>> entries;
+
+	while ( countSyscall( SYSCALL_DIR ), (file = readdir(dir)) ) {
+		const char *p = file->d_name;
+
+		// ignore "." and ".."
+		if ( p[0] == '.' ) {
+			if (ctx.excludeHidden)
+				continue;
+			if ( p[1] == 0 || (p[1] == '.' && p[2] == 0) )
+				continue;
+		}
+
+#ifdef DT_UNKNOWN
+		entries.emplace_back( p, file->d_type );
+#else
+		entries.emplace_back( p, 0 );
+#endif
+	}
+
+	std::sort(entries.begin(), entries.end());
+	node->children.reserve( entries.size() );
+
+	for ( const auto &e : entries ) {
+		const char *name = e.first.c_str();
+		struct stat st;
+		bool isDir = false;
+
+		scanNode_t child;
+		child.name = e.first;
+		child.path = node->path + "/" + e.first;
+		child.size = 0;
+		child.hidden = false;
+		child.mtime = -1;
+
+		// d_type spares us a stat() for directories and regular files,
+		// anything else may be a symbolic link to a directory, which is
+		// packed as a directory
+#ifdef DT_UNKNOWN
+		if ( e.second == DT_DIR )
+			isDir = true;
+		else if ( e.second != DT_REG )
+#endif
+		{
+			isDir = ( fstatat(self->fd(), name, &st, 0) == 0 && S_ISDIR(st.st_mode) );
+			countSyscall( SYSCALL_STAT );
+		}
+
+		if ( isDir ) {
+			if ( ctx.matches(ctx.unpackDir, child.path) )
+				continue;
+
+			child.type = 'D';
+			node->children.push_back( std::move(child) );
+			continue;
+		}
+
+		if ( ctx.matches(ctx.unpack, child.path) )
+			continue;
+
+		countSyscall( SYSCALL_STAT );
+		if ( fstatat(self->fd(), name, &st, AT_SYMLINK_NOFOLLOW) == -1 ) {
+			perror(child.path.c_str());
+			ctx.failed = true;
+			return;
+		}
+
+		if (S_ISLNK(st.st_mode)) {
+			char buf[4096];
+			ssize_t len = readlinkat( self->fd(), name, buf, sizeof(buf) );
+			countSyscall( SYSCALL_READ );
+
+			if ( len > 0 )
+				child.link_target.assign( buf, len );
+			child.type = 'L';
+		} else {
+			child.size = st.st_size;
+			child.type = (st.st_mode & S_IXUSR) ? 'X' : 'F';
+			child.mtime = std::max<int64_t>( st.st_mtime, st.st_ctime );
+
+			if ( ctx.dedup && st.st_nlink > 1 ) {
+				child.dev = st.st_dev;
+				child.ino = st.st_ino;
+			}
+		}
+
+		node->children.push_back( std::move(child) );
+	}
+#endif  // !_WIN32
+
+	// hash a file for deduplication
+	auto hashFile = [&ctx] ( scanNode_t *p, std::shared_ptr<scanDir_t> dir ) {
+		if ( ctx.failed )
+			return;
+
+		statsScope scope( *ctx.stats );
+
+		std::vector<char> vBuf( std::min<uint64_t>(p->size, BUFF_SIZE) );
+		sha256 ctxHash;
+		uint64_t pos = 0;
+
+#ifdef _WIN32
+		std::ifstream ifsFile( p->path, std::ios::binary );
+#else
+		int fd = ::openat( dir->fd(), p->name.c_str(), O_RDONLY | O_CLOEXEC );
+		countSyscall( SYSCALL_OPEN );
+#endif
+		while ( pos < p->size ) {
+			size_t n = std::min<uint64_t>( p->size - pos, BUFF_SIZE );
+#ifdef _WIN32
+			bool ok = ifsFile.read( vBuf.data(), n ).good();
+#else
+			bool ok = ( fd != -1 && preadAll( fd, vBuf.data(), n, pos ) );
+#endif
+			if ( !ok ) {
+				std::cerr << "cannot read file: " << p->path << std::endl;
+				ctx.failed = true;
+				break;
+			}
+
+			ctxHash.update( vBuf.data(), n );
+			pos += n;
+		}
+#ifndef _WIN32
+		if ( fd != -1 ) {
+			::close(fd);
+			countSyscall( SYSCALL_OPEN );
+		}
+#endif
+		ctxHash.final( p->digest );
+		p->hashed = true;
+	};
+
+	// node->children won't change anymore, so the pointers stay valid
+	for ( auto &child : node->children ) {
+		scanNode_t *p = &child;
+
+		if ( child.type == 'D' ) {
+			ctx.pool->push( worker, [&ctx, p, self] (unsigned w) { scanDirectory(ctx, w, p, self); } );
+		} else if ( ctx.dedup && child.type != 'L' && child.size > 0 && ctx.claim(child) ) {
+			ctx.pool->push( worker, [hashFile, p, self] (unsigned) { hashFile(p, self); } );
+		}
+	}
+}
+
+// Walk the directory root.path on a pool of m_jobs threads
+bool asarArchive::scanTree( scanNode_t &root, const pathMatcher *unpack, const pathMatcher *unpackDir, bool excludeHidden ) {
+	unsigned jobs = m_jobs ? m_jobs : std::max( std::thread::hardware_concurrency(), 1u );
+	workPool pool(jobs);
+	scanContext_t ctx;
+
+	ctx.pool = &pool;
+	ctx.stats = &m_stats;
+	ctx.unpack = ( unpack && !unpack->empty() ) ? unpack : NULL;
+	ctx.unpackDir = ( unpackDir && !unpackDir->empty() ) ? unpackDir : NULL;
+	ctx.rootLen = root.path.size() + 1;
+	ctx.excludeHidden = excludeHidden;
+	ctx.dedup = m_bDedup;
+	ctx.failed = false;
+
+	root.type = 'D';
+	pool.push( 0, [&ctx, &root] (unsigned w) { scanDirectory(ctx, w, &root, NULL); } );
+	pool.run();
+
+	if ( ctx.failed )
+		return false;
+
+	// only one name of a hard linked file was hashed, give
+	// the others its digest so they all match other copies
+	if ( ctx.dedup && !ctx.setInodes.empty() ) {
+		std::map<std::pair<uint64_t, uint64_t>, const uint8_t *> mapDigest;
+		std::function<void(scanNode_t &, bool)> walk = [&] (scanNode_t &dir, bool bSet) {
+			for ( auto &e : dir.children ) {
+				if ( e.type == 'D' ) {
+					walk( e, bSet );
+				} else if ( e.ino != 0 && e.hashed == !bSet ) {
+					if ( !bSet )
+						mapDigest[std::make_pair(e.dev, e.ino)] = e.digest;
+					else {
+						auto it = mapDigest.find( std::make_pair(e.dev, e.ino) );
+						if ( it != mapDigest.end() ) {
+							memcpy( e.digest, it->second, 32 );
+							e.hashed = true;
+						}
+					}
+				}
+			}
+		};
+		walk( root, false );
+		walk( root, true );
+	}
+
+	return true;
+}
+
+// rapidjson output stream that appends to a std::string
+struct stringOutput_t {
+	typedef char Ch;
+	std::string &s;
+
+	explicit stringOutput_t( std::string &str ) : s(str) {}
+	void Put( char c ) { s.push_back(c); }
+	void Flush() {}
+};
+
+struct asarArchive::headerWriter_t {
+	stringOutput_t out;
+	rapidjson::Writer<stringOutput_t> writer;
+	uint64_t szOffset;
+	entryTable &files;
+	std::vector<hashJob_t> *pvHashJobs;
+
+	// deduplication: files index of the stored files by content and
+	// inode, header position of their integrity hash and where to copy it
+	std::unordered_map<std::string, size_t> mapDigest;
+	std::map<std::pair<uint64_t, uint64_t>, size_t> mapInode;
+	std::unordered_map<size_t, size_t> mapHashPos;
+	std::vector<std::pair<size_t, size_t>> &vDigestCopies;
+
+	// header position of every offset and its files index, for applyOrdering()
+	std::vector<std::pair<size_t, uint32_t>> *pvOffsetPos = NULL;
+
+	headerWriter_t( std::string &sHeader, entryTable &table, std::vector<hashJob_t> *pvJobs,
+			std::vector<std::pair<size_t, size_t>> &vCopies ) :
+		out(sHeader),
+		writer(out),
+		szOffset(0),
+		files(table),
+		pvHashJobs(pvJobs),
+		vDigestCopies(vCopies)
+	{}
+
+	// queue the digest of job, or copy it from the file the data is shared with;
+	// the data is hashed again if that file has no digest in the header
+	void addJob( const hashJob_t &job, const entryTable::entry_t &entry, size_t orig, size_t hashPos ) {
+		auto it = entry.shared ? mapHashPos.find(orig) : mapHashPos.end();
+
+		if ( it != mapHashPos.end() )
+			vDigestCopies.emplace_back( job.pos, it->second + (job.pos - hashPos) );
+		else
+			pvHashJobs->push_back(job);
+	}
+
+	// index of an earlier stored (not shared) file with the same content
+	// as e, or index
+	size_t stored( const scanNode_t &e, size_t index ) {
+		size_t found = index;
+		size_t *pInode = NULL;
+
+		if ( e.ino != 0 ) {
+			auto r = mapInode.emplace( std::make_pair(e.dev, e.ino), index );
+			found = r.first->second;
+			pInode = &r.first->second;
+		}
+
+		if ( e.hashed ) {
+			auto r = mapDigest.emplace( std::string(reinterpret_cast<const char *>(e.digest), 32), found );
+			if ( found == index && !r.second && files[r.first->second].size == e.size )
+				found = r.first->second;
+		}
+
+		// other names of the inode then resolve to the stored file as well
+		if ( pInode )
+			*pInode = found;
+
+		return found;
+	}
+
+	// bytes the header will roughly need, names are assumed to need no escaping
+	static size_t sizeHint( const scanNode_t &dir, bool bIntegrity ) {
+		size_t n = 0;
+
+		for ( const auto &e : dir.children ) {
+			n += e.name.size() + 16;
+
+			if ( e.type == 'D' )
+				n += sizeHint( e, bIntegrity );
+			else if ( e.type == 'L' )
+				n += e.link_target.size() + 8;
+			else {
+				n += 48;
+				if ( bIntegrity )
+					n += 128 + 67 * (e.size / INTEGRITY_BLOCK_SIZE + 1);
+			}
+		}
+
+		return n;
+	}
+};
+
+// The value of an "offset" string of the header: plain decimal digits,
+// no sign, spaces or locale; false if there are none, anything else or
+// the value doesn't fit into 64 bits
+static bool fromDecimal( const char *str, size_t len, uint64_t &value ) {
+	uint64_t v = 0;
+
+	if ( len == 0 )
+		return false;
+
+	for ( size_t i = 0; i < len; i++ ) {
+		unsigned d = static_cast<unsigned char>(str[i]) - '0';
+
+		if ( d > 9 || v > (UINT64_MAX - d) / 10 )
+			return false;
+		v = v * 10 + d;
+	}
+
+	value = v;
+	return true;
+}
+
+// decimal digits of v, returns their number
+static size_t toDecimal( uint64_t v, char *buf ) {
+	char tmp[20];
+	size_t n = 0;
+
+	do {
+		tmp[n++] = '0' + (v % 10);
+		v /= 10;
+	} while ( v > 0 );
+
+	for ( size_t i = 0; i < n; i++ )
+		buf[i] = tmp[n - 1 - i];
+
+	return n;
+}
+
+// Write the JSON header for root into sHeader and fill files with
+// its entries, the source files are root.path + '/' + files.path().
+// Integrity digests of deduplicated files are not hashed again,
+// vDigestCopies gets the header positions to copy them (to, from).
+// pvOffsetPos, if not NULL, gets those of the offsets for applyOrdering().
+void asarArchive::createJsonHeader(
+		const scanNode_t &root,
+		std::string &sHeader,
+		entryTable &files,
+		std::vector<hashJob_t> *pvHashJobs,
+		std::vector<std::pair<size_t, size_t>> &vDigestCopies,
+		std::vector<std::pair<size_t, uint32_t>> *pvOffsetPos
+) {
+	auto start = std::chrono::steady_clock::now();
+	traceScope trace( m_trace, "header" );
+
+	sHeader.clear();
+	sHeader.reserve( 32 + headerWriter_t::sizeHint( root, pvHashJobs != NULL ) );
+	vDigestCopies.clear();
+
+	headerWriter_t w( sHeader, files, pvHashJobs, vDigestCopies );
+
+	if ( pvOffsetPos ) {
+		pvOffsetPos->clear();
+		w.pvOffsetPos = pvOffsetPos;
+	}
+
+	w.writer.StartObject();
+	w.writer.Key("files");
+	w.writer.StartObject();
+	writeJsonDir( w, root, entryTable::NONE );
+	w.writer.EndObject();
+	w.writer.EndObject();
+
+	m_stats.headerBytes += sHeader.size();
+	m_stats.headerNanos += std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+}
+
+void asarArchive::writeJsonDir( headerWriter_t &w, const scanNode_t &dir, uint32_t parent ) {
+	rapidjson::Writer<stringOutput_t> &writer = w.writer;
+
+	for ( const auto &e : dir.children ) {
+		uint32_t index = w.files.add( parent, e.name.data(), e.name.size(), e.type );
+
+		writer.Key( e.name.data(), e.name.size() );
+		writer.StartObject();
+
+		if ( e.type == 'D' ) {
+			m_stats.dirs++;
+			w.files[index].size = e.children.size();
+			writer.Key("files");
+			writer.StartObject();
+			writeJsonDir( w, e, index );
+			writer.EndObject();
+			writer.EndObject();
+			continue;
+		}
+
+		// a reference, the table doesn't grow until the next entry
+		entryTable::entry_t &entry = w.files[index];
+		entry.size = e.size;
+		entry.offset = w.szOffset;
+
+		size_t orig = index;
+		bool bStored = ( e.type != 'L' && e.size > 0 && (e.hashed || e.ino != 0) );
+
+		if ( bStored )
+			orig = w.stored( e, orig );
+
+		if ( orig != index ) {
+			entry.offset = w.files[orig].offset;
+			entry.shared = true;
+			m_stats.dedupFiles++;
+			m_stats.dedupBytes += e.size;
+		}
+
+		if ( e.type == 'L' ) {
+			m_stats.links++;
+			writer.Key("link");
+			writer.String( e.link_target.data(), e.link_target.size() );
+			w.files.setLink( index, e.link_target.data(), e.link_target.size() );
+		} else {
+			m_stats.files++;
+			char buf[20];
+
+			writer.Key("size");
+			writer.Uint64( e.size );
+			writer.Key("offset");
+			size_t len = toDecimal( entry.offset, buf );
+			writer.String( buf, len );
+			if ( w.pvOffsetPos )
+				w.pvOffsetPos->emplace_back( w.out.s.size() - len - 1, index );
+
+			if ( w.pvHashJobs ) {
+				// the digests are written over the zeros once the data was hashed,
+				// upstream also hashes an empty last block if the size is a
+				// multiple of the block size
+				static const char zeros[] = "0000000000000000000000000000000000000000000000000000000000000000";
+				std::string &sHeader = w.out.s;
+				size_t hashPos;
+				hashJob_t job;
+
+				job.file = index;
+				job.offset = 0;
+				job.size = e.size;
+				job.block = -1;
+				job.expected = NULL;
+
+				writer.Key("integrity");
+				writer.StartObject();
+				writer.Key("algorithm");
+				writer.String("SHA256");
+				writer.Key("hash");
+				writer.String( zeros, 64 );
+				job.pos = hashPos = sHeader.size() - 65;
+				if ( bStored && !entry.shared )
+					w.mapHashPos[orig] = hashPos;
+				w.addJob( job, entry, orig, hashPos );
+				writer.Key("blockSize");
+				writer.Uint( INTEGRITY_BLOCK_SIZE );
+				writer.Key("blocks");
+				writer.StartArray();
+
+				for ( size_t i = 0; i <= e.size / INTEGRITY_BLOCK_SIZE; i++ ) {
+					job.offset = i * INTEGRITY_BLOCK_SIZE;
+					job.size = std::min<uint64_t>( e.size - job.offset, INTEGRITY_BLOCK_SIZE );
+					job.block = i;
+					writer.String( zeros, 64 );
+					job.pos = sHeader.size() - 65;
+					w.addJob( job, entry, orig, hashPos );
+				}
+
+				writer.EndArray();
+				writer.EndObject();
+			}
+
+			if ( e.type == 'X' ) {
+				writer.Key("executable");
+				writer.Bool(true);
+			}
+			if ( e.hidden ) {
+				writer.Key("hidden");
+				writer.Bool(true);
+			}
+			if ( !entry.shared )
+				w.szOffset += e.size;
+		}
+
+		writer.EndObject();
+	}
+}
+
+// Read an ordering file of upstream asar: a path relative to the packed
+// directory per line, anything up to the last ':' is left out so
+// "<pid>: <path>" lines work, and so are leading separators.
+static bool readOrdering( const std::string &sPath, std::vector<std::string> &vPaths ) {
+	std::ifstream ifs( sPath );
+
+	if ( !ifs.is_open() ) {
+		std::cerr << "cannot open ordering file: " << sPath << std::endl;
+		return false;
+	}
+
+	std::string sLine;
+
+	while ( std::getline(ifs, sLine) ) {
+		size_t pos = sLine.rfind( ':' );
+		if ( pos != std::string::npos )
+			sLine.erase( 0, pos + 1 );
+
+		size_t first = sLine.find_first_not_of( " \t\r" );
+		size_t last = sLine.find_last_not_of( " \t\r" );
+		if ( first == std::string::npos )
+			continue;
+		sLine = sLine.substr( first, last - first + 1 );
+
+		// "." and empty components don't count
+		std::string sFile;
+		size_t end;
+
+		for ( pos = 0; pos <= sLine.size(); pos = end + 1 ) {
+			end = sLine.find_first_of( DIR_SEPARATORS, pos );
+			if ( end == std::string::npos )
+				end = sLine.size();
+			if ( end == pos || (end == pos + 1 && sLine[pos] == '.') )
+				continue;
+
+			if ( !sFile.empty() )
+				sFile.push_back( '/' );
+			sFile.append( sLine, pos, end - pos );
+		}
+
+		if ( !sFile.empty() )
+			vPaths.push_back( sFile );
+	}
+
+	return true;
+}
+
+// Move the data of the files listed in the ordering file to the front, in
+// the listed order, the others follow as they were. The offsets are
+// rewritten in sHeader at vOffsetPos and the header positions of
+// vHashJobs and vDigestCopies are moved along.
+bool asarArchive::applyOrdering(
+	entryTable &files,
+	std::string &sHeader,
+	const std::vector<std::pair<size_t, uint32_t>> &vOffsetPos,
+	std::vector<hashJob_t> &vHashJobs,
+	std::vector<std::pair<size_t, size_t>> &vDigestCopies
+) {
+	std::vector<std::string> vPaths;
+
+	if ( !readOrdering( m_sOrdering, vPaths ) )
+		return false;
+
+	traceScope trace( m_trace, "ordering" );
+
+	// the files that store data, by offset as the header was written
+	std::vector<uint32_t> vStored;
+
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		const entryTable::entry_t &e = files[i];
+		if ( (e.type == 'F' || e.type == 'X') && !e.shared && e.size > 0 )
+			vStored.push_back( i );
+	}
+
+	auto byOffset = [&files] ( uint32_t i, uint64_t offset ) { return files[i].offset < offset; };
+
+	// a listed file that shares its data ranks the file that stores it
+	std::vector<uint32_t> vRank( files.size(), entryTable::NONE );
+	size_t found = 0;
+
+	files.buildIndex();
+
+	for ( size_t k = 0; k < vPaths.size(); k++ ) {
+		uint32_t i = files.find( vPaths[k] );
+
+		if ( i == entryTable::NONE || (files[i].type != 'F' && files[i].type != 'X') )
+			continue;
+		found++;
+
+		if ( files[i].shared ) {
+			auto it = std::lower_bound( vStored.begin(), vStored.end(), files[i].offset, byOffset );
+			if ( it == vStored.end() )
+				continue;
+			i = *it;
+		}
+
+		vRank[i] = std::min<uint32_t>( vRank[i], k );
+	}
+
+	// old and new offset of the stored data
+	std::vector<std::pair<uint64_t, uint64_t>> vMove;
+	uint64_t offset = 0;
+	size_t hotFiles = 0;
+	uint64_t hotBytes = 0;
+
+	std::stable_sort( vStored.begin(), vStored.end(), [&vRank] (uint32_t a, uint32_t b) {
+		return vRank[a] < vRank[b];
+	});
+	vMove.reserve( vStored.size() );
+
+	for ( const auto i : vStored ) {
+		if ( vRank[i] != entryTable::NONE ) {
+			hotFiles++;
+			hotBytes += files[i].size;
+		}
+		vMove.emplace_back( files[i].offset, offset );
+		offset += files[i].size;
+	}
+
+	std::sort( vMove.begin(), vMove.end() );
+
+	// empty files go where the data after them went
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		entryTable::entry_t &e = files[i];
+
+		if ( e.type == 'D' || e.type == 'L' )
+			continue;
+
+		auto it = std::lower_bound( vMove.begin(), vMove.end(), std::make_pair(e.offset, static_cast<uint64_t>(0)) );
+		e.offset = ( it == vMove.end() ) ? offset : it->second;
+	}
+
+	// the header with the new offsets, vShift has the end of every
+	// offset in the old header and how far the text after it moved
+	std::string sNew;
+	std::vector<std::pair<size_t, int64_t>> vShift;
+	size_t last = 0;
+	int64_t shift = 0;
+
+	sNew.reserve( sHeader.size() + 64 );
+	vShift.reserve( vOffsetPos.size() );
+
+	for ( const auto &p : vOffsetPos ) {
+		size_t end = sHeader.find( '"', p.first );
+		char buf[20];
+		size_t len = toDecimal( files[p.second].offset, buf );
+
+		sNew.append( sHeader, last, p.first - last );
+		sNew.append( buf, len );
+		shift += static_cast<int64_t>(len) - static_cast<int64_t>(end - p.first);
+		vShift.emplace_back( end, shift );
+		last = end;
+	}
+
+	sNew.append( sHeader, last, std::string::npos );
+	sHeader.swap( sNew );
+
+	auto moved = [&vShift] ( size_t pos ) -> size_t {
+		auto it = std::upper_bound( vShift.begin(), vShift.end(), pos,
+			[] (size_t v, const std::pair<size_t, int64_t> &s) { return v < s.first; } );
+		return ( it == vShift.begin() ) ? pos : pos + (it - 1)->second;
+	};
+
+	for ( auto &job : vHashJobs )
+		job.pos = moved( job.pos );
+	for ( auto &c : vDigestCopies ) {
+		c.first = moved( c.first );
+		c.second = moved( c.second );
+	}
+
+	std::cerr << "ordering: " << found << " of " << vPaths.size() << " listed files found, "
+		<< hotFiles << " files (" << hotBytes << " bytes) placed first" << std::endl;
+
+	return true;
+}
+
+// Add the entries of object below parent to files, a directory comes
+// before its members and its size is their number. Returns the number
+// of members of object, -1 if it is not an object.
+// Add the members of a "files" object to files. pvIntegrity, if not NULL,
+// gets the "integrity" objects of the files by index (NULL if none) and
+// is only valid while the DOM is.
+int asarArchive::getFiles( rapidjson::Value& object, entryTable &files, uint32_t parent,
+		std::vector<const rapidjson::Value *> *pvIntegrity ) {
+	if ( !object.IsObject() ) // how ?
+		return -1;
+
+	int n = 0;
+
+	for ( auto itr = object.MemberBegin(); itr != object.MemberEnd(); ++itr, ++n ) {
+		rapidjson::Value& vMember = itr->value;
+		if ( !vMember.IsObject() ) continue;
+
+		const char *name = itr->name.GetString();
+		size_t len = itr->name.GetStringLength();
+
+		if ( vMember.HasMember("files") ) {
+			uint32_t dir = files.add( parent, name, len, 'D' );
+			int ret = getFiles( vMember["files"], files, dir, pvIntegrity );
+
+			if ( ret == -1 )
+				return -1;
+			files[dir].size = ret;
+		} else {
+			if ( vMember.HasMember("link") && vMember["link"].IsString() ) {
+				uint32_t i = files.add( parent, name, len, 'L' );
+				files.setLink( i, vMember["link"].GetString(), vMember["link"].GetStringLength() );
+				continue;
+			} else if ( vMember.HasMember("directory") && vMember["directory"].IsString() ) {
+				files.add( parent, name, len, 'D' );
+				continue;
+			}
+
+			uint64_t offset;
+
+			if ( !( vMember.HasMember("size") && vMember.HasMember("offset") &&
+					vMember["size"].IsUint64() && vMember["offset"].IsString() &&
+					fromDecimal( vMember["offset"].GetString(), vMember["offset"].GetStringLength(), offset ) ) )
+				continue;
+
+			char type = 'F';
+
+#ifndef _WIN32
+			if (vMember.HasMember("executable") && vMember["executable"].IsBool() &&
+				vMember["executable"].GetBool() == true)
+				type = 'X';
+#endif
+
+			uint32_t i = files.add( parent, name, len, type );
+			files[i].size = vMember["size"].GetUint64();
+			files[i].offset = offset;
+
+			if ( pvIntegrity && vMember.HasMember("integrity") && vMember["integrity"].IsObject() ) {
+				pvIntegrity->resize( files.size(), NULL );
+				(*pvIntegrity)[i] = &vMember["integrity"];
+			}
+		}
+	}
+
+	if ( pvIntegrity )
+		pvIntegrity->resize( files.size(), NULL );
+
+	return n;
+}
+
+// SAX handler for the JSON header. It adds the entries to an entryTable
+// by the same rules as getFiles() without building the whole DOM, and
+// hands every entry to emit() as soon as it is complete; directories
+// when their members are.
+//
+// With a selection (see setSelection()) only the selected files, links
+// and empty directories and the directories they are in are added, the
+// members of directories nothing can be selected in are skipped unread.
+struct asarArchive::headerHandler_t : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, headerHandler_t> {
+	enum { IN_ROOT, IN_DIR, IN_ENTRY };
+
+	// how far the selection is satisfied for a directory and what is in it
+	enum {
+		SEL_INSIDE = 1,    // below one of the subtrees
+		SEL_INCLUDED = 2,  // matches include
+		SEL_ALL = SEL_INSIDE | SEL_INCLUDED
+	};
+
+	typedef struct {
+		int kind;
+		size_t count;  // IN_DIR: number of members
+		uint32_t dir;  // IN_DIR: table index of the directory
+		bool isDir;    // IN_ENTRY: has a "files" member
+		int sel;       // IN_DIR: selection flags
+		size_t pathLen;  // IN_DIR: length of sPath of the parent
+	} frame_t;
+
+	entryTable &files;
+	const std::function<bool(size_t)> &emit;
+	std::vector<frame_t> vStack;
+
+	// selection, include and exclude are NULL if they are empty
+	bool bSelect = false;
+	const pathMatcher *include = NULL;
+	const pathMatcher *exclude = NULL;
+	const std::vector<std::string> *pvSubtrees = NULL;
+	std::vector<bool> vFound;  // the subtrees seen
+	std::string sPath;  // of the current directory, only kept with a selection
+	std::string sEntry;
+	std::string sKey;
+	int skip = 0;  // depth inside a value we don't care about
+	bool hasFiles = false;
+	bool aborted = false;  // emit() returned false
+
+	// the entry being read
+	std::string sName;
+	std::string sLink;
+	uint64_t size, offset;
+	bool hasSize, hasOffset, hasLink, hasDirectory, isExecutable;
+
+	headerHandler_t( entryTable &table, const std::function<bool(size_t)> &f ) :
+		files(table),
+		emit(f)
+	{}
+
+	int top() const { return vStack.empty() ? -1 : vStack.back().kind; }
+
+	bool push( int kind, uint32_t dir = entryTable::NONE, int sel = SEL_ALL, size_t pathLen = 0 ) {
+		frame_t f = { kind, 0, dir, false, sel, pathLen };
+		vStack.push_back(f);
+		return true;
+	}
+
+	// selection flags of the entry sEntry in a directory with the flags sel,
+	// -1 if neither it nor anything in it can be selected
+	int select( int sel, bool isDir ) {
+		if ( exclude && exclude->match(sEntry) )
+			return -1;
+
+		if ( !(sel & SEL_INSIDE) ) {
+			const std::vector<std::string> &v = *pvSubtrees;
+			bool bAncestor = false;
+
+			for ( size_t i = 0; i < v.size(); i++ ) {
+				if ( v[i] == sEntry ) {
+					sel |= SEL_INSIDE;
+					vFound[i] = true;
+				} else if ( isDir && v[i].size() > sEntry.size() && v[i][sEntry.size()] == '/' &&
+					v[i].compare(0, sEntry.size(), sEntry) == 0 )
+				{
+					bAncestor = true;
+				}
+			}
+
+			if ( !(sel & SEL_INSIDE) && !bAncestor )
+				return -1;
+		}
+
+		if ( !(sel & SEL_INCLUDED) ) {
+			if ( include->match(sEntry) )
+				sel |= SEL_INCLUDED;
+			else if ( !isDir || !include->matchBelow(sEntry) )
+				return -1;
+		}
+
+		return sel;
+	}
+
+	// sEntry = path of sName in the current directory
+	void entryPath() {
+		sEntry.assign( sPath );
+		if ( !sEntry.empty() )
+			sEntry.push_back( '/' );
+		sEntry.append( sName );
+	}
+
+	bool StartObject() {
+		if ( skip > 0 || (top() != -1 && top() != IN_DIR && sKey != "files") ) {
+			skip++;
+			return true;
+		}
+
+		switch ( top() ) {
+		case -1:
+			return push(IN_ROOT);
+		case IN_ROOT:
+			hasFiles = true;
+			if ( bSelect )
+				return push( IN_DIR, entryTable::NONE, (pvSubtrees->empty() ? SEL_INSIDE : 0) | (include ? 0 : SEL_INCLUDED) );
+			return push(IN_DIR);
+		case IN_DIR:
+			// a new entry, sKey is its name
+			sName.swap( sKey );
+			hasSize = hasOffset = hasLink = hasDirectory = isExecutable = false;
+			return push(IN_ENTRY);
+		default:
+			break;
+		}
+
+		// "files" of a directory entry, below the entry is its parent
+		const frame_t &parent = vStack[vStack.size() - 2];
+		int sel = SEL_ALL;
+		size_t pathLen = sPath.size();
+
+		if ( bSelect ) {
+			entryPath();
+			sel = select( parent.sel, true );
+			if ( sel == -1 ) {
+				skip++;
+				return true;
+			}
+			sPath.swap( sEntry );
+		}
+
+		return push( IN_DIR, files.add( parent.dir, sName.data(), sName.size(), 'D' ), sel, pathLen );
+	}
+
+	bool EndObject( rapidjson::SizeType ) {
+		if ( skip > 0 ) {
+			skip--;
+			return true;
+		}
+
+		frame_t f = vStack.back();
+		vStack.pop_back();
+
+		if ( f.kind == IN_DIR && top() == IN_ENTRY ) {
+			files[f.dir].size = f.count;
+
+			if ( bSelect ) {
+				sPath.resize( f.pathLen );
+
+				// nothing selected in it and not selected as an empty directory
+				if ( f.dir == files.size() - 1 && (f.count > 0 || f.sel != SEL_ALL) ) {
+					files.pop_back();
+					return true;
+				}
+			}
+
+			return send( f.dir );
+		} else if ( f.kind == IN_ENTRY && !f.isDir ) {
+			uint32_t parent = vStack.back().dir;
+			uint32_t i;
+
+			if ( bSelect && (hasLink || hasDirectory || (hasSize && hasOffset)) ) {
+				entryPath();
+				if ( select( vStack.back().sel, hasDirectory ) != SEL_ALL )
+					return true;
+			}
+
+			if ( hasLink ) {
+				i = files.add( parent, sName.data(), sName.size(), 'L' );
+				files.setLink( i, sLink.data(), sLink.size() );
+			} else if ( hasDirectory ) {
+				i = files.add( parent, sName.data(), sName.size(), 'D' );
+			} else if ( hasSize && hasOffset ) {
+				i = files.add( parent, sName.data(), sName.size(), isExecutable ? 'X' : 'F' );
+				files[i].size = size;
+				files[i].offset = offset;
+			} else {
+				return true;
+			}
+
+			return send(i);
+		}
+
+		return true;
+	}
+
+	bool send( size_t i ) {
+		if ( emit && !emit(i) )
+			aborted = true;
+		return !aborted;
+	}
+
+	bool StartArray() { skip++; return true; }
+	bool EndArray( rapidjson::SizeType ) { skip--; return true; }
+
+	bool Key( const char *str, rapidjson::SizeType len, bool ) {
+		if ( skip > 0 )
+			return true;
+
+		sKey.assign( str, len );
+
+		if ( top() == IN_DIR )
+			vStack.back().count++;
+		else if ( top() == IN_ENTRY && sKey == "files" )
+			vStack.back().isDir = true;
+
+		return true;
+	}
+
+	bool String( const char *str, rapidjson::SizeType len, bool ) {
+		if ( skip > 0 || top() != IN_ENTRY )
+			return true;
+
+		if ( sKey == "link" ) {
+			hasLink = true;
+			sLink.assign( str, len );
+		} else if ( sKey == "directory" ) {
+			hasDirectory = true;
+		} else if ( sKey == "offset" ) {
+			hasOffset = fromDecimal( str, len, offset );
+		}
+
+		return true;
+	}
+
+	bool Uint64( uint64_t u ) {
+		if ( skip == 0 && top() == IN_ENTRY && sKey == "size" ) {
+			size = u;
+			hasSize = true;
+		}
+		return true;
+	}
+
+	bool Uint( unsigned u ) { return Uint64(u); }
+	bool Int( int i ) { return i < 0 || Uint64(i); }
+	bool Int64( int64_t i ) { return i < 0 || Uint64(i); }
+
+	bool Bool( bool b ) {
+#ifndef _WIN32
+		if ( skip == 0 && top() == IN_ENTRY && sKey == "executable" )
+			isExecutable = b;
+#endif
+		return true;
+	}
+};
+
+// Parse the header of the archive opened by openArchive() into files and
+// call emit(), if set, with the index of every entry as soon as it was
+// read. Stops and returns false when emit() does. With bSelect only the
+// entries selected by setSelection() are read.
+bool asarArchive::streamHeader( entryTable &files, const std::function<bool(size_t)> &emit, bool bSelect ) {
+	const char *headerBuf;
+	uint32_t uSize;
+	std::vector<char> vBuf;
+
+	if ( !findHeader( headerBuf, uSize, vBuf ) )
+		return false;
+
+	traceScope trace( m_trace, "parse" );
+	headerHandler_t handler( files, emit );
+
+	if ( bSelect ) {
+		handler.bSelect = true;
+		handler.include = ( m_pInclude && !m_pInclude->empty() ) ? m_pInclude : NULL;
+		handler.exclude = ( m_pExclude && !m_pExclude->empty() ) ? m_pExclude : NULL;
+		handler.pvSubtrees = &m_vSubtrees;
+		handler.vFound.assign( m_vSubtrees.size(), false );
+	}
+
+	rapidjson::Reader reader;
+	rapidjson::MemoryStream ms( headerBuf, uSize );
+	rapidjson::ParseResult res = reader.Parse( ms, handler );
+
+	if ( handler.aborted )
+		return false;
+
+	if ( !res ) {
+		std::cout << rapidjson::GetParseError_En(res.Code()) << std::endl;
+		return false;
+	}
+
+	if ( !handler.hasFiles ) {
+		std::cerr << "JSON header has no file list" << std::endl;
+		return false;
+	}
+
+	bool ret = true;
+
+	for ( size_t i = 0; i < handler.vFound.size(); i++ ) {
+		if ( !handler.vFound[i] ) {
+			std::cerr << "not found in archive: " << m_vSubtrees[i] << std::endl;
+			ret = false;
+		}
+	}
+
+	return ret;
+}
+
+#ifndef _WIN32
+// Extraction of small files and symbolic links through io_uring. Every
+// file is a chain of openat() into a direct descriptor, write() from the
+// archive mapping and close(), up to URING_FILES of them are in flight.
+// The slot of the direct descriptor also indexes the file's state.
+struct asarArchive::uringBatch_t {
+	enum {
+		OP_OPEN = 0,
+		OP_WRITE,
+		OP_CLOSE,
+		OP_SYMLINK
+	};
+
+	typedef struct {
+		size_t index;  // into files
+		std::string path;
+		unsigned ops;  // completions still to come
+		bool failed;
+		uint64_t start;
+	} slot_t;
+
+	const entryTable *files = NULL;
+	uringQueue ring;
+	std::vector<slot_t> vSlots;
+	std::vector<unsigned> vFree;
+	std::vector<char> fileBuf;  // for files redone with unpackSingleFile()
+	unsigned pending = 0;  // completions still to come
+
+	bool init() {
+		if ( !ring.init( URING_FILES * 4, URING_FILES ) )
+			return false;
+
+		vSlots.resize( URING_FILES );
+		for ( unsigned i = URING_FILES; i > 0; i-- )
+			vFree.push_back( i - 1 );
+		fileBuf.resize( BUFF_SIZE );
+		return true;
+	}
+
+	size_t inFlight() const { return vSlots.size() - vFree.size(); }
+};
+
+// queue a file, sPath is swapped with a string of the batch
+bool asarArchive::uringAdd( uringBatch_t &b, size_t index, std::string &sPath ) {
+	const entryTable::entry_t &file = (*b.files)[index];
+	uint64_t uPos = m_headerSize + file.offset;
+
+	if ( file.type != 'L' && ( uPos > m_mapSize || file.size > m_mapSize - uPos ) )
+		return unpackSingleFile( *b.files, index, sPath, b.fileBuf.data() );  // reports the error
+
+	if ( b.ring.space() < 3 && !uringReap( b, 0 ) )
+		return false;
+
+	// all slots taken, wait for a good part of them instead of
+	// entering the kernel again for every single file
+	while ( b.vFree.empty() ) {
+		if ( !uringReap( b, std::min<unsigned>( b.pending, URING_FILES ) ) )
+			return false;
+	}
+
+	unsigned slot = b.vFree.back();
+	b.vFree.pop_back();
+
+	uringBatch_t::slot_t &s = b.vSlots[slot];
+	s.index = index;
+	s.path.swap( sPath );
+	s.failed = false;
+	s.start = m_trace.enabled() ? m_trace.now() : 0;
+
+	uint64_t data = uint64_t(slot) << 2;
+
+	if ( file.type == 'L' ) {
+		s.ops = 1;
+		b.pending++;
+		b.ring.symlinkat( b.files->link(index), AT_FDCWD, s.path.c_str(), data | uringBatch_t::OP_SYMLINK );
+		return true;
+	}
+
+	// a failed open cancels the rest, close() also follows a failed write
+	b.ring.openat( AT_FDCWD, s.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666, slot,
+		data | uringBatch_t::OP_OPEN, uringQueue::LINK_SUCCESS );
+	s.ops = 2;
+
+	if ( file.size > 0 ) {
+		b.ring.write( slot, m_pMap + uPos, file.size, 0, data | uringBatch_t::OP_WRITE, uringQueue::LINK_ALWAYS );
+		s.ops++;
+	}
+
+	b.ring.close( slot, data | uringBatch_t::OP_CLOSE );
+	b.pending += s.ops;
+
+	return true;
+}
+
+// Submit the queued files, wait for at least wait completions and finish
+// the files that are complete. Files with a failed operation are redone
+// with the blocking system calls, that also reports the error.
+bool asarArchive::uringReap( uringBatch_t &b, unsigned wait ) {
+	countSyscall( SYSCALL_URING );
+	if ( !b.ring.submit(wait) ) {
+		perror("io_uring_enter()");
+		return false;
+	}
+
+	bool ret = true;
+	uint64_t data;
+	int res;
+
+	while ( b.ring.complete(data, res) ) {
+		unsigned slot = data >> 2;
+		uringBatch_t::slot_t &s = b.vSlots[slot];
+		const entryTable::entry_t &file = (*b.files)[s.index];
+		b.pending--;
+
+		if ( (data & 3) == uringBatch_t::OP_WRITE ) {
+			if ( res > 0 )
+				m_stats.bytesWritten += res;
+			if ( res != static_cast<int>(file.size) )
+				s.failed = true;  // a short write, too
+		} else if ( res < 0 ) {
+			s.failed = true;
+		}
+
+		if ( --s.ops > 0 )
+			continue;
+
+		if ( s.failed ) {
+			if ( !unpackSingleFile( *b.files, s.index, s.path, b.fileBuf.data() ) )
+				ret = false;
+		} else if ( file.type == 'L' ) {
+			m_stats.links++;
+		} else {
+			if ( file.size > 0 ) {
+				m_stats.copyFiles[COPY_URING]++;
+				m_stats.copyBytes[COPY_URING] += file.size;
+			}
+			if ( file.type == 'X' ) {
+				chmod( s.path.c_str(), 0775 );
+				countSyscall( SYSCALL_MKDIR );
+			}
+			m_stats.files++;
+			if ( m_trace.enabled() )
+				m_trace.file( "extract", s.path, file.size, s.start );
+		}
+
+		b.vFree.push_back( slot );
+	}
+
+	return ret;
+}
+#endif  // !_WIN32
+
+#ifndef _WIN32
+// Descriptors of the directories files are extracted into, so a file is
+// created relative to its directory instead of the kernel resolving its
+// whole path again. Every worker has its own; the DIRFD_CACHE most
+// recently used directories are kept open, files extracted one after
+// another are mostly in the same few directories.
+struct asarArchive::dirCache_t {
+	const entryTable &files;
+	const std::string &sOutPath;
+	std::vector<std::pair<uint32_t, int>> vFds;  // directory, descriptor; most recently used last
+	std::string sPath;
+
+	dirCache_t( const entryTable &table, const std::string &sOut ) :
+		files(table),
+		sOutPath(sOut)
+	{}
+
+	~dirCache_t() {
+		for ( const auto &p : vFds ) {
+			::close( p.second );
+			countSyscall( SYSCALL_OPEN );
+		}
+	}
+
+	// descriptor of directory dir (NONE for sOutPath), -1 if it can't be opened
+	int get( uint32_t dir ) {
+		for ( size_t i = vFds.size(); i > 0; i-- ) {
+			if ( vFds[i - 1].first == dir ) {
+				std::pair<uint32_t, int> p = vFds[i - 1];
+				vFds.erase( vFds.begin() + (i - 1) );
+				vFds.push_back( p );
+				return p.second;
+			}
+		}
+
+		sPath.assign( sOutPath );
+		if ( dir != entryTable::NONE )
+			files.appendPath( dir, sPath );
+
+		int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+#ifdef O_PATH
+		flags = O_PATH | O_DIRECTORY | O_CLOEXEC;  // only used to look up names
+#endif
+		int fd = ::open( sPath.c_str(), flags );
+		countSyscall( SYSCALL_OPEN );
+
+		if ( fd == -1 )
+			return -1;
+
+		if ( vFds.size() == DIRFD_CACHE ) {
+			::close( vFds.front().second );
+			countSyscall( SYSCALL_OPEN );
+			vFds.erase( vFds.begin() );
+		}
+		vFds.push_back( std::make_pair(dir, fd) );
+
+		return fd;
+	}
+};
+#else
+struct asarArchive::dirCache_t {
+	dirCache_t( const entryTable &, const std::string & ) {}
+	int get( uint32_t ) { return -1; }
+};
+#endif
+
+// Sort the files (indices into files) by the position of their data, so
+// the archive is read front to back, and group them into runs: small files
+// whose data is at most COALESCE_GAP bytes apart are read with a single
+// pread() of up to BUFF_SIZE bytes and written from that buffer. Links
+// have no data and go last.
+void asarArchive::planRuns( const entryTable &files, std::vector<uint32_t> &vFiles, std::vector<extractRun_t> &vRuns ) {
+	auto before = [&files] (uint32_t i, uint32_t j) {
+		const entryTable::entry_t &a = files[i];
+		const entryTable::entry_t &b = files[j];
+
+		if ( a.type == 'L' || b.type == 'L' )
+			return b.type == 'L' && a.type != 'L';
+		return a.offset < b.offset;
+	};
+
+	// the header usually is in the order of the data already
+	if ( !std::is_sorted( vFiles.begin(), vFiles.end(), before ) )
+		std::stable_sort( vFiles.begin(), vFiles.end(), before );
+
+	for ( size_t i = 0; i < vFiles.size(); i++ ) {
+		const entryTable::entry_t &f = files[ vFiles[i] ];
+		bool bLink = (f.type == 'L');
+		uint64_t start = bLink ? 0 : f.offset;
+		uint64_t end = bLink ? 0 : f.offset + f.size;
+		bool small = bLink || f.size <= COALESCE_MAX_FILE;
+
+		if ( !vRuns.empty() ) {
+			extractRun_t &r = vRuns.back();
+
+			if ( r.small && small && start <= r.end + COALESCE_GAP && std::max(r.end, end) - r.start <= BUFF_SIZE ) {
+				r.last = i + 1;
+				r.end = std::max( r.end, end );
+				continue;
+			}
+		}
+
+		extractRun_t r = { i, i + 1, start, end, small };
+		vRuns.push_back( r );
+	}
+}
+
+// extract the files of a run below sOutPath, fileBuf has BUFF_SIZE bytes
+bool asarArchive::extractRun( const entryTable &files, const std::vector<uint32_t> &vFiles, const extractRun_t &run,
+		const std::string &sOutPath, dirCache_t &dirs, char *fileBuf ) {
+	uint64_t size = run.end - run.start;
+	bool bCoalesced = (run.last - run.first > 1 && size > 0);
+	std::string sPath;
+
+	// planRuns() only groups files that fit into fileBuf
+	if ( bCoalesced && size > BUFF_SIZE ) {
+		std::cerr << "Invalid run of archive data for " << sOutPath << files.path( vFiles[run.first] ) << std::endl;
+		return false;
+	}
+
+	if ( bCoalesced && !readAt(fileBuf, static_cast<size_t>(size), m_headerSize + run.start) ) {
+		std::cerr << "Error when reading archive data for " << sOutPath << files.path( vFiles[run.first] ) << std::endl;
+		return false;
+	}
+
+	for ( size_t i = run.first; i < run.last; i++ ) {
+		const entryTable::entry_t &f = files[ vFiles[i] ];
+		const char *pData = (bCoalesced && f.type != 'L') ? fileBuf + static_cast<size_t>(f.offset - run.start) : NULL;
+
+		sPath.assign( sOutPath );
+		files.appendPath( vFiles[i], sPath );
+
+		if ( !unpackSingleFile(files, vFiles[i], sPath, fileBuf, pData, dirs.get(f.parent)) )
+			return false;
+	}
+
+#ifndef _WIN32
+	if ( m_bNoCache && size > 0 )
+		dropCache( m_fd, m_headerSize + run.start, size, false );
+#endif
+
+	return true;
+}
+
+// Extract all files below sOutPath. The header is parsed into an entry
+// table first and the directories are created, then the files are
+// extracted in the order of their data (see planRuns()) by the workers,
+// with posix_fadvise(WILLNEED) ahead of them. With setUring() the small
+// files and links are instead written through io_uring from this thread.
+bool asarArchive::unpackFiles( const std::string &sOutPath ) {
+	unsigned jobs = m_jobs;
+#ifdef _WIN32
+	// reads go through the shared ifstream
+	jobs = 1;
+#else
+	if ( jobs == 0 )
+		jobs = std::max( std::thread::hardware_concurrency(), 1u );
+#endif
+
+	entryTable files;
+
+	if ( !streamHeader( files, nullptr, true ) )
+		return false;
+
+	// Directories are created for the entries in them and if they are
+	// empty, parents come first in the table. Links go after the files,
+	// as planRuns() wants them.
+	std::vector<uint32_t> vFiles, vLinks;
+	std::vector<bool> vMkdir( files.size(), false );
+
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		const entryTable::entry_t &e = files[i];
+
+		if ( e.type == 'D' ) {
+			if ( e.size > 0 )
+				continue;
+			vMkdir[i] = true;
+		} else if ( e.type == 'L' ) {
+			vLinks.push_back( i );
+		} else {
+			vFiles.push_back( i );
+		}
+
+		for ( uint32_t p = e.parent; p != entryTable::NONE && !vMkdir[p]; p = files[p].parent )
+			vMkdir[p] = true;
+	}
+
+	if ( vFiles.empty() && vLinks.empty() && std::find( vMkdir.begin(), vMkdir.end(), true ) == vMkdir.end() )
+		return true;
+
+	{
+		traceScope trace( m_trace, "mkdir" );
+		std::string sDir( sOutPath );
+
+		// like "mkdir -p" for sOutPath
+		for ( auto &c : sDir ) {
+			if ( IS_DIR_SEPARATOR(c) ) {
+				c = 0;
+				_mkdir(sDir.c_str());
+				countSyscall( SYSCALL_MKDIR );
+				c = '/';
+			}
+		}
+
+		for ( size_t i = 0; i < files.size(); i++ ) {
+			if ( !vMkdir[i] )
+				continue;
+
+			sDir.assign( sOutPath );
+			files.appendPath( i, sDir );
+			countSyscall( SYSCALL_MKDIR );
+
+			if ( _mkdir(sDir.c_str()) != 0 && errno != EEXIST ) {
+				perror( sDir.c_str() );
+				return false;
+			}
+			m_stats.dirs++;
+		}
+	}
+
+	std::vector<extractRun_t> vRuns;
+	{
+		traceScope trace( m_trace, "plan" );
+		vFiles.insert( vFiles.end(), vLinks.begin(), vLinks.end() );
+		planRuns( files, vFiles, vRuns );
+	}
+
+	traceScope trace( m_trace, "extract" );
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	// more readahead by the kernel
+	::posix_fadvise( m_fd, m_headerSize, 0, POSIX_FADV_SEQUENTIAL );
+	countSyscall( SYSCALL_CACHE );
+#endif
+
+	// Called when a run is started, keeps posix_fadvise(WILLNEED) issued
+	// for the runs up to READAHEAD_WINDOW bytes ahead of it. Big files are
+	// left out, copy_file_range() may reflink them without reading.
+	std::mutex adviseMutex;
+	size_t adviseNext = 0;
+
+	auto adviseAhead = [&] (size_t run) {
+#ifdef POSIX_FADV_WILLNEED
+		std::lock_guard<std::mutex> lock( adviseMutex );
+		uint64_t limit = vRuns[run].start + READAHEAD_WINDOW;
+
+		// still more than half a window ahead
+		if ( adviseNext < vRuns.size() && vRuns[adviseNext].start + READAHEAD_WINDOW / 2 > limit )
+			return;
+
+		uint64_t from = 0, to = 0;
+
+		auto advise = [&] () {
+			if ( to > from ) {
+				::posix_fadvise( m_fd, m_headerSize + from, to - from, POSIX_FADV_WILLNEED );
+				countSyscall( SYSCALL_CACHE );
+			}
+		};
+
+		for ( ; adviseNext < vRuns.size() && vRuns[adviseNext].start < limit; adviseNext++ ) {
+			const extractRun_t &r = vRuns[adviseNext];
+
+			if ( !r.small )
+				continue;
+			if ( r.start > to + COALESCE_GAP ) {
+				advise();
+				from = r.start;
+			}
+			to = std::max( to, r.end );
+		}
+		advise();
+#else
+		(void) run;
+#endif
+	};
+
+	// runs for the workers and for the ring, in the order of their data
+	std::vector<size_t> vWorkerRuns, vRingRuns;
+
+#ifndef _WIN32
+	// the ring writes straight from the mapping
+	std::unique_ptr<uringBatch_t> pUring;
+
+	if ( m_bUring && !m_bNoCache && m_pMap ) {
+		pUring.reset( new uringBatch_t );
+		pUring->files = &files;
+		if ( !pUring->init() )
+			pUring.reset();
+	}
+#endif
+
+	for ( size_t i = 0; i < vRuns.size(); i++ ) {
+#ifndef _WIN32
+		if ( pUring && ( vRuns[i].small || vRuns[i].end - vRuns[i].start <= URING_MAX_FILE ) ) {
+			vRingRuns.push_back( i );
+			continue;
+		}
+#endif
+		vWorkerRuns.push_back( i );
+	}
+
+	std::atomic<size_t> next(0);
+	std::atomic<bool> failed(false);
+
+	auto worker = [&] () {
+		statsScope scope( m_stats );
+		std::vector<char> fileBuf(BUFF_SIZE);
+		dirCache_t dirs( files, sOutPath );
+		size_t k;
+
+		while ( !failed && (k = next++) < vWorkerRuns.size() ) {
+			adviseAhead( vWorkerRuns[k] );
+			if ( !extractRun(files, vFiles, vRuns[vWorkerRuns[k]], sOutPath, dirs, fileBuf.data()) )
+				failed = true;
+		}
+	};
+
+	std::vector<std::thread> vThreads;
+
+	if ( jobs > 1 ) {
+		for ( unsigned i = 0; i < jobs && i < vWorkerRuns.size(); i++ )
+			vThreads.emplace_back(worker);
+	}
+
+#ifndef _WIN32
+	std::string sPath;
+
+	for ( size_t i : vRingRuns ) {
+		if ( failed )
+			break;
+
+		adviseAhead( i );
+		for ( size_t j = vRuns[i].first; j < vRuns[i].last && !failed; j++ ) {
+			sPath.assign( sOutPath );
+			files.appendPath( vFiles[j], sPath );
+
+			if ( !uringAdd( *pUring, vFiles[j], sPath ) )
+				failed = true;
+		}
+	}
+#endif
+
+	if ( jobs == 1 )
+		worker();
+
+#ifndef _WIN32
+	// wait for the ring even after an error, it still uses the paths
+	while ( pUring && pUring->inFlight() > 0 ) {
+		size_t n = pUring->inFlight();
+
+		if ( !uringReap( *pUring, 1 ) ) {
+			failed = true;
+			if ( pUring->inFlight() == n )
+				break;  // the ring itself failed
+		}
+	}
+#endif
+
+	for ( auto &t : vThreads )
+		t.join();
+
+	return !failed;
+}
+
+// read from the archive at an absolute position
+bool asarArchive::readAt( char *buf, size_t size, uint64_t offset ) {
+#ifdef _WIN32
+	std::lock_guard<std::mutex> lock(m_readMutex);
+	m_ifsInputFile.clear();
+	m_ifsInputFile.seekg(offset);
+	return static_cast<bool>( m_ifsInputFile.read(buf, size) );
+#else
+	return preadAll(m_fd, buf, size, offset);
+#endif
+}
+
+// Extract one entry to sOutPath, the data is copied from the archive or
+// taken from pData if the caller already read it. With a descriptor of
+// its directory in dirFd, the entry is created relative to it.
+bool asarArchive::unpackSingleFile( const entryTable &files, size_t index, const std::string &sOutPath, char *fileBuf,
+		const char *pData, int dirFd ) {
+	const entryTable::entry_t &file = files[index];
+
+	if (file.type == 'L') {
+#ifdef _WIN32
+		// symbolic links (not .lnk files!) on Windows/NTFS are used differently
+		// from Unix, so instead we create a text file with the link target
+		std::ofstream ofsOutputFile( sOutPath.c_str(), std::ios::trunc );
+
+		if ( !ofsOutputFile ) {
+			std::cerr << "Error when writing to file " << sOutPath << std::endl;
+			return false;
+		}
+		ofsOutputFile << files.link(index);
+		ofsOutputFile.close();
+#else
+		countSyscall( SYSCALL_MKDIR );
+		if ( symlinkat( files.link(index), dirFd == -1 ? AT_FDCWD : dirFd,
+				dirFd == -1 ? sOutPath.c_str() : files.name(index) ) != 0 ) {
+			perror("symlink()");
+			return false;
+		}
+#endif
+		m_stats.links++;
+		return true;
+	} else if (file.type == 'D') {
+		m_stats.dirs++;
+		countSyscall( SYSCALL_MKDIR );
+		return (_mkdir(sOutPath.c_str()) == 0);
+	}
+
+	uint64_t start = m_trace.enabled() ? m_trace.now() : 0;
+
+	uint64_t uSize = file.size;
+	uint64_t uPos = m_headerSize + file.offset;
+
+	if ( m_pMap && ( uPos > m_mapSize || uSize > m_mapSize - uPos ) ) {
+		std::cerr << "Error when reading archive data for " << sOutPath << std::endl;
+		return false;
+	}
+
+#ifdef _WIN32
+	std::ofstream ofsOutputFile( sOutPath.c_str(), std::ios::trunc | std::ios::binary );
+
+	if ( !ofsOutputFile ) {
+		std::cerr << "Error when writing to file " << sOutPath << std::endl;
+		return false;
+	}
+
+	if ( pData ) {
+		ofsOutputFile.write(pData, uSize);
+		uSize = 0;
+	}
+
+	while (uSize > 0) {
+		size_t uChunk = std::min<uint64_t>(uSize, BUFF_SIZE);
+
+		if ( !readAt(fileBuf, uChunk, uPos) ) {
+			std::cerr << "Error when reading archive data for " << sOutPath << std::endl;
+			return false;
+		}
+		ofsOutputFile.write(fileBuf, uChunk);
+		uSize -= uChunk;
+		uPos += uChunk;
+	}
+
+	ofsOutputFile.close();
+	if ( file.size > 0 ) {
+		m_stats.copyFiles[COPY_BUFFERED]++;
+		m_stats.copyBytes[COPY_BUFFERED] += file.size;
+	}
+#else
+	int fdOut = ::openat( dirFd == -1 ? AT_FDCWD : dirFd, dirFd == -1 ? sOutPath.c_str() : files.name(index),
+		O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+	countSyscall( SYSCALL_OPEN );
+
+	if ( fdOut == -1 ) {
+		std::cerr << "Error when writing to file " << sOutPath << std::endl;
+		return false;
+	}
+
+	int method;
+
+	if ( pData )
+		method = pwriteAll( fdOut, pData, uSize, 0 ) ? COPY_BUFFERED : -1;
+	else
+		method = copyData( m_fd, uPos, fdOut, 0, uSize, m_pMap ? m_pMap + uPos : NULL, fileBuf );
+
+	if ( m_bNoCache && method != -1 && uSize > 0 )
+		dropCache( fdOut, 0, 0, true );
+
+	if ( file.type == 'X' ) {
+		fchmod( fdOut, 0775 );
+		countSyscall( SYSCALL_MKDIR );
+	}
+
+	countSyscall( SYSCALL_OPEN );
+	if ( ::close(fdOut) != 0 )
+		method = -1;
+
+	if ( method == -1 ) {
+		std::cerr << "Error when extracting file " << sOutPath << std::endl;
+		return false;
+	}
+
+	if ( uSize > 0 ) {
+		m_stats.copyFiles[method]++;
+		m_stats.copyBytes[method] += uSize;
+	}
+#endif
+
+	m_stats.files++;
+	if ( m_trace.enabled() )
+		m_trace.file( "extract", sOutPath, file.size, start );
+
+	return true;
+}
+
+bool asarArchive::openArchive( const std::string &sArchivePath ) {
+	traceScope trace( m_trace, "open" );
+
+#ifdef _WIN32
+	m_ifsInputFile.open( sArchivePath, std::ios::binary );
+	if ( !m_ifsInputFile ) {
+		std::cerr << "cannot open file: " << sArchivePath << std::endl;
+		return false;
+	}
+#else
+	m_fd = ::open( sArchivePath.c_str(), O_RDONLY | O_CLOEXEC );
+	countSyscall( SYSCALL_OPEN );
+	if ( m_fd == -1 ) {
+		perror( sArchivePath.c_str() );
+		return false;
+	}
+
+	// map the whole archive once, header and payloads are then used
+	// in place; if that fails or the archive doesn't fit into the
+	// address space (32-bit builds) we fall back to buffered reads
+	struct stat st;
+	countSyscall( SYSCALL_STAT );
+	if ( ::fstat(m_fd, &st) == 0 && st.st_size > 0 && static_cast<uint64_t>(st.st_size) <= SIZE_MAX ) {
+		void *p = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+		if ( p != MAP_FAILED ) {
+			m_pMap = static_cast<const char *>(p);
+			m_mapSize = st.st_size;
+		}
+	}
+#endif
+	return true;
+}
+
+void asarArchive::closeArchive() {
+	m_ifsInputFile.close();
+#ifndef _WIN32
+	if ( m_pMap ) {
+		::munmap(const_cast<char *>(m_pMap), m_mapSize);
+		m_pMap = NULL;
+		m_mapSize = 0;
+	}
+	if ( m_fd != -1 ) {
+		// also the pages that were mapped
+		if ( m_bNoCache )
+			dropCache( m_fd, 0, 0, false );
+		::close(m_fd);
+		countSyscall( SYSCALL_OPEN );
+		m_fd = -1;
+	}
+#endif
+}
+
+// Get a view of the archive bytes at [offset, offset+size).
+// It points into the mapping if there is one, otherwise the
+// data is copied into vBuf.
+bool asarArchive::getView( uint64_t offset, size_t size, const char *&pData, std::vector<char> &vBuf ) {
+	if ( m_pMap ) {
+		if ( offset > m_mapSize || size > m_mapSize - offset )
+			return false;
+		pData = m_pMap + offset;
+		return true;
+	}
+
+	vBuf.resize(size);
+	if ( !readAt(vBuf.data(), size, offset) )
+		return false;
+	pData = vBuf.data();
+	return true;
+}
+
+// Check the 16 byte prefix of the archive opened by openArchive(),
+// pHeader then points to the uSize bytes of the JSON header
+bool asarArchive::findHeader( const char *&pHeader, uint32_t &uSize, std::vector<char> &vBuf ) {
+	// first 16 bytes consist of 4 numbers stored as uint32_t little endian:
+	// uHdr1 = 4
+	// uHdr2 = <JSON header size> + 8
+	// uHdr3 = <JSON header size> + 4
+	// uSize = <JSON header size>
+	const char *sizeBuf;
+
+	if ( !getView( 0, 16, sizeBuf, vBuf ) ) {
+		std::cerr << "unexpected file header size" << std::endl;
+		return false;
+	}
+
+	uint32_t uHdr[4];
+	memcpy( uHdr, sizeBuf, 16 );
+
+	const uint32_t uHdr1 = le32toh( uHdr[0] );
+	const uint32_t uHdr2 = le32toh( uHdr[1] );
+	const uint32_t uHdr3 = le32toh( uHdr[2] );
+	uSize = le32toh( uHdr[3] );
+
+	// The JSON header is written in 4 byte blocks so it can contain spaces at the end
+	const unsigned short int uHdrX = uSize % 4 > 0 ? 4 - uSize % 4 : 0;
+
+	if ( uHdr1 != 4 ||
+		( uHdr2 != (uSize + uHdrX + 8) && uHdr2 != (uSize + 8) ) ||
+		( uHdr3 != (uSize + uHdrX + 4) && uHdr3 != (uSize + 4) ) ) {
+		std::cerr << "unexpected file header data" << std::endl;
+		return false;
+	}
+
+	// file data starts right after the (padded) header
+	m_headerSize = uHdr2 + 8;
+
+	if ( !getView( 16, uSize, pHeader, vBuf ) ) {
+		std::cerr << "JSON header data too short" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// DOM of the JSON header. It is parsed in place, so the strings point
+// into buf instead of being copied, and all values come from a single
+// pool that is sized for the header up front.
+struct asarArchive::headerDom_t {
+	std::unique_ptr<char[]> buf;
+	std::unique_ptr<rapidjson::MemoryPoolAllocator<>> pool;
+	std::unique_ptr<rapidjson::Document> json;  // goes before pool and buf
+};
+
+// Parse the JSON header of the archive opened by openArchive() into dom
+bool asarArchive::loadHeader( headerDom_t &dom ) {
+	const char *headerBuf;
+	uint32_t uSize;
+	std::vector<char> vBuf;
+
+	if ( !findHeader( headerBuf, uSize, vBuf ) )
+		return false;
+
+	traceScope trace( m_trace, "parse" );
+
+	// ParseInsitu() writes into the buffer, so this is a copy and not
+	// the read-only mapping; no need to zero it first
+	dom.buf.reset( new char[uSize + 1] );
+	memcpy( dom.buf.get(), headerBuf, uSize );
+	dom.buf[uSize] = 0;
+
+	// the DOM of a typical header is about as big as its text
+	dom.pool.reset( new rapidjson::MemoryPoolAllocator<>( std::max<size_t>( uSize, HEADER_POOL_MIN ) ) );
+	dom.json.reset( new rapidjson::Document( dom.pool.get() ) );
+
+	rapidjson::Document &json = *dom.json;
+	rapidjson::ParseResult res = json.ParseInsitu( dom.buf.get() );
+
+	if ( !res ) {
+		std::cout << rapidjson::GetParseError_En(res.Code()) << std::endl;
+		return false;
+	}
+
+	if ( !json.IsObject() || !json.HasMember("files") ) {
+		std::cerr << "JSON header has no file list" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Files and subtrees that unpack() extracts, subtrees are normalized here
+void asarArchive::setSelection( const pathMatcher *include, const pathMatcher *exclude, const std::vector<std::string> &vSubtrees ) {
+	m_pInclude = include;
+	m_pExclude = exclude;
+	m_vSubtrees.clear();
+
+	// relative to the archive root, '/' separated and without a trailing '/'
+	for ( const auto &sSubtree : vSubtrees ) {
+		std::string s;
+
+		for ( size_t i = 0; i < sSubtree.size(); i++ ) {
+			if ( IS_DIR_SEPARATOR(sSubtree[i]) ) {
+				if ( !s.empty() && s.back() != '/' )
+					s.push_back( '/' );
+			} else if ( sSubtree[i] == '.' && s.empty() && (i + 1 == sSubtree.size() || IS_DIR_SEPARATOR(sSubtree[i + 1])) ) {
+				i++;  // "./"
+			} else {
+				s.push_back( sSubtree[i] );
+			}
+		}
+
+		if ( !s.empty() && s.back() == '/' )
+			s.pop_back();
+		if ( s.empty() ) {
+			// the whole archive
+			m_vSubtrees.clear();
+			break;
+		}
+		m_vSubtrees.push_back( s );
+	}
+}
+
+// Unpack archive to a specific location
+bool asarArchive::unpack( const std::string &sArchivePath, std::string sOutPath, std::string sExtractFile ) {
+	if ( !sExtractFile.empty() )
+		return extractFiles( sArchivePath, std::vector<std::string>(1, sExtractFile) );
+
+	statsScope scope( m_stats );
+
+	close();
+
+	if ( !openArchive(sArchivePath) )
+		return false;
+
+	if ( !sOutPath.empty() && !IS_DIR_SEPARATOR( sOutPath.back() ) )
+		sOutPath.push_back( '/' );
+
+	bool ret;
+
+	if ( sOutPath.empty() ) {
+		// print file list while the header is parsed, directories
+		// only if they are empty; only the directories are kept
+		// unless the table goes into an index
+		entryTable files;
+		std::string sPath;
+
+		auto print = [&] (size_t i) {
+			if ( files[i].type != 'D' || files[i].size == 0 ) {
+				sPath.clear();
+				files.appendPath( i, sPath );
+				std::cout << sPath << '\n';
+			}
+		};
+
+		if ( m_bIndex && loadIndex( sArchivePath, files ) ) {
+			for ( size_t i = 0; i < files.size(); i++ )
+				print(i);
+			ret = true;
+		} else {
+			ret = streamHeader( files, [&] (size_t i) {
+				print(i);
+				if ( !m_bIndex && files[i].type != 'D' )
+					files.pop_back();
+				return true;
+			});
+
+			if ( ret && m_bIndex ) {
+				files.buildIndex();
+				saveIndex( sArchivePath, files );
+			}
+		}
+		std::cout.flush();
+	} else {
+		// extract all files
+		DIR *dir = opendir( sOutPath.c_str() );
+		countSyscall( SYSCALL_DIR );
+
+		// check if directory is empty
+		if ( dir ) {
+			int i = 0;
+			while ( countSyscall( SYSCALL_DIR ), readdir(dir) ) i++;
+			closedir(dir);
+			if (i > 2) {
+				std::cerr << "directory is not empty: " << sOutPath << std::endl;
+				closeArchive();
+				return false;
+			}
+		} else if (errno != ENOENT ) {
+			// "Directory does not exist" is the only error we accept
+			int errsv = errno;
+			std::cerr << "error trying to open directory:" << std::endl;
+			errno = errsv;
+			perror( sOutPath.c_str() );
+			closeArchive();
+			return false;
+		}
+
+		ret = unpackFiles( sOutPath );
+	}
+
+	closeArchive();
+
+	return ret;
+}
+
+// the 16 bytes in front of a JSON header of size bytes
+static void sizePickle( char *cHeader, uint32_t size ) {
+	char *p = cHeader;
+
+	// offset 0x00
+	uint32_t uSize = htole32(4);
+	memcpy( p, &uSize, 4 );
+	p = cHeader + 4;
+
+	// offset 0x04
+	uSize = htole32( size + 8 );
+	memcpy( p, &uSize, 4 );
+	p += 4;
+
+	// offset 0x08
+	uSize = htole32( size + 4 );
+	memcpy( p, &uSize, 4 );
+	p += 4;
+
+	// offset 0x0C
+	uSize = htole32( size );
+	memcpy( p, &uSize, 4 );
+}
+
+// path of the source file of entry i of pack(), in s
+static void sourcePath( const std::string &sRoot, const entryTable &files, size_t i, std::string &s ) {
+	s.assign( sRoot ).push_back( '/' );
+	files.appendPath( i, s );
+}
+
+// previous archive for pack --base
+struct asarArchive::baseArchive_t {
+	asarArchive archive;
+	headerDom_t dom;  // keeps the integrity objects alive
+	entryTable files;
+	std::vector<const rapidjson::Value *> integrity;  // of files, by index
+	int64_t mtime = -1;  // of the archive file
+
+	bool open( const std::string &sPath ) {
+		if ( !archive.openArchive(sPath) )
+			return false;
+
+		if ( !archive.loadHeader(dom) ||
+				archive.getFiles( (*dom.json)["files"], files, entryTable::NONE, &integrity ) == -1 )
+			return false;
+
+		files.buildIndex();
+
+#ifndef _WIN32
+		struct stat st;
+		countSyscall( SYSCALL_STAT );
+		if ( fstat(archive.m_fd, &st) == 0 )
+			mtime = st.st_mtime;
+#endif
+		return true;
+	}
+
+	// the SHA-256 of file i if it has upstream style integrity data
+	const char *hash( uint32_t i ) const {
+		const rapidjson::Value *v = integrity[i];
+
+		if ( v && v->HasMember("algorithm") && (*v)["algorithm"].IsString() &&
+				strcmp( (*v)["algorithm"].GetString(), "SHA256" ) == 0 &&
+				v->HasMember("hash") && (*v)["hash"].IsString() &&
+				(*v)["hash"].GetStringLength() == 64 )
+			return (*v)["hash"].GetString();
+
+		return NULL;
+	}
+
+	// the hash of block n of file i, if the blocks are the ones pack() would write
+	const char *block( uint32_t i, size_t n ) const {
+		const rapidjson::Value *v = integrity[i];
+
+		if ( !hash(i) || !v->HasMember("blockSize") || !(*v)["blockSize"].IsUint() ||
+				(*v)["blockSize"].GetUint() != INTEGRITY_BLOCK_SIZE ||
+				!v->HasMember("blocks") || !(*v)["blocks"].IsArray() ||
+				(*v)["blocks"].Size() != files[i].size / INTEGRITY_BLOCK_SIZE + 1 )
+			return NULL;
+
+		const rapidjson::Value &b = (*v)["blocks"][n];
+		return ( b.IsString() && b.GetStringLength() == 64 ) ? b.GetString() : NULL;
+	}
+};
+
+// Decide which files of files can be copied from the base archive:
+// same path and size, and the same SHA-256 as stored in the base archive
+// or, if it has none and m_bBaseTrustMtime is set, not changed since the
+// base archive file was written. vBaseOffset gets the position of their
+// data in the base archive, -1 for all others. Integrity digests of taken
+// files are copied into sHeader and their jobs are removed from vHashJobs.
+bool asarArchive::planReuse(
+	baseArchive_t &base,
+	const scanNode_t &root,
+	const entryTable &files,
+	std::vector<hashJob_t> &vHashJobs,
+	std::string &sHeader,
+	std::vector<int64_t> &vBaseOffset
+) {
+	std::vector<uint32_t> vBaseIndex( files.size(), entryTable::NONE );
+	std::vector<hashJob_t> vCheck;
+	size_t unchecked = 0;  // candidates that can't be compared
+
+	vBaseOffset.assign( files.size(), -1 );
+
+	// the mtimes are in the scan tree, whose nodes createJsonHeader()
+	// added to files in this order
+	std::vector<const scanNode_t *> vNodes;
+
+	if ( m_bBaseTrustMtime ) {
+		std::function<void(const scanNode_t &)> addNodes = [&] ( const scanNode_t &dir ) {
+			for ( const auto &e : dir.children ) {
+				vNodes.push_back( &e );
+				if ( e.type == 'D' )
+					addNodes( e );
+			}
+		};
+		addNodes( root );
+	}
+
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		const entryTable::entry_t &e = files[i];
+
+		// same path: the parent was looked up before, as it comes first
+		if ( e.parent == entryTable::NONE || vBaseIndex[e.parent] != entryTable::NONE ) {
+			uint32_t parent = ( e.parent == entryTable::NONE ) ? entryTable::NONE : vBaseIndex[e.parent];
+			const char *name = files.name(i);
+			vBaseIndex[i] = base.files.find( parent, name, strlen(name) );
+		}
+
+		if ( (e.type != 'F' && e.type != 'X') || e.shared || vBaseIndex[i] == entryTable::NONE )
+			continue;
+
+		const entryTable::entry_t &old = base.files[ vBaseIndex[i] ];
+		if ( (old.type != 'F' && old.type != 'X') || old.size != e.size )
+			continue;
+
+		if ( base.hash( vBaseIndex[i] ) ) {
+			hashJob_t job;
+			job.file = i;
+			job.offset = 0;
+			job.size = e.size;
+			job.block = -1;
+			job.pos = 0;
+			job.expected = base.hash( vBaseIndex[i] );
+			vCheck.push_back(job);
+		} else if ( m_bBaseTrustMtime ) {
+			int64_t mtime = ( vNodes.size() == files.size() ) ? vNodes[i]->mtime : -1;
+			if ( mtime != -1 && base.mtime != -1 && mtime < base.mtime )
+				vBaseOffset[i] = base.archive.m_headerSize + old.offset;
+		} else {
+			unchecked++;
+		}
+	}
+
+	if ( unchecked > 0 )
+		std::cerr << "warning: " << m_sBaseArchive << " has no integrity data for " << unchecked
+			<< " files, they are read from disk; pack it with --integrity or pass --base-trust-mtime" << std::endl;
+
+	if ( !vCheck.empty() && !hashFiles( files, root.path, vCheck, false ) )
+		return false;
+
+	for ( const auto &job : vCheck ) {
+		char hex[64];
+		sha256::toHex( job.digest, hex );
+
+		if ( memcmp( hex, job.expected, 64 ) == 0 )
+			vBaseOffset[job.file] = base.archive.m_headerSize + base.files[ vBaseIndex[job.file] ].offset;
+	}
+
+	// the digests of taken files are the same as in the base archive,
+	// unless it has no or different integrity data
+	if ( !vHashJobs.empty() ) {
+		std::vector<bool> vHasDigests( files.size(), false );
+
+		for ( size_t i = 0; i < files.size(); i++ )
+			vHasDigests[i] = ( vBaseOffset[i] != -1 && base.block( vBaseIndex[i], 0 ) );
+
+		for ( const auto &job : vHashJobs ) {
+			if ( vHasDigests[job.file] ) {
+				uint32_t old = vBaseIndex[job.file];
+				const char *p = ( job.block == -1 ) ? base.hash(old) : base.block( old, job.block );
+
+				if ( p )
+					memcpy( &sHeader[job.pos], p, 64 );
+				else
+					vHasDigests[job.file] = false;
+			}
+		}
+
+		auto it = std::remove_if( vHashJobs.begin(), vHashJobs.end(), [&vHasDigests] (const hashJob_t &job) {
+			return vHasDigests[job.file];
+		});
+		vHashJobs.erase( it, vHashJobs.end() );
+	}
+
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		const entryTable::entry_t &e = files[i];
+
+		if ( e.type == 'L' || e.type == 'D' || e.shared ) {
+			continue;
+		} else if ( vBaseOffset[i] != -1 ) {
+			m_stats.reuseFiles++;
+			m_stats.reuseBytes += e.size;
+		} else {
+			m_stats.freshFiles++;
+			m_stats.freshBytes += e.size;
+		}
+	}
+
+	return true;
+}
+
+#ifndef _WIN32
+// Copy the data of files into the archive on m_jobs threads. Every
+// file has its final offset already, so the copies don't depend on each
+// other and the archive is the same as if they were done one by one.
+// Files that follow each other in both archives are copied in one go.
+bool asarArchive::copyPayloads(
+	const std::string &sArchivePath,
+	int fdOut,
+	off_t dataPos,
+	const std::string &sRoot,
+	const entryTable &files,
+	const std::vector<int64_t> &vBaseOffset,
+	baseArchive_t *base
+) {
+	typedef struct {
+		size_t file;   // first file
+		size_t count;  // number of entries, more than one only from the base archive
+		uint64_t size;
+	} copyTask_t;
+
+	std::vector<copyTask_t> vTasks;
+	uint64_t szData = 0;
+
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		const entryTable::entry_t &e = files[i];
+
+		// skip directories, symbolic links and files whose data is already stored
+		if ( e.type == 'D' || e.type == 'L' || e.shared )
+			continue;
+
+		copyTask_t task = { i, 1, e.size };
+
+		if ( vBaseOffset[i] != -1 ) {
+			// directories in between have no data
+			for ( size_t j = i + 1; j < files.size(); j++ ) {
+				if ( files[j].type == 'D' )
+					continue;
+				if ( files[j].shared || vBaseOffset[j] != vBaseOffset[i] + static_cast<int64_t>(task.size) ||
+						files[j].offset != e.offset + task.size )
+					break;
+
+				task.size += files[j].size;
+				task.count = j - i + 1;
+			}
+		}
+
+		szData = std::max( szData, e.offset + task.size );
+		vTasks.push_back(task);
+		i += task.count - 1;
+	}
+
+	// allocate the whole archive up front, so the writers don't
+	// extend the file one after another and it isn't fragmented
+	off_t total = dataPos + szData;
+
+#ifdef __linux__
+	countSyscall( SYSCALL_WRITE );
+	if ( szData > 0 && ::fallocate(fdOut, 0, 0, total) != 0 && !isCopyUnsupported(errno) ) {
+		perror( sArchivePath.c_str() );
+		return false;
+	}
+#endif
+
+	countSyscall( SYSCALL_WRITE );
+	if ( ::ftruncate(fdOut, total) != 0 ) {
+		perror( sArchivePath.c_str() );
+		return false;
+	}
+
+	unsigned jobs = m_jobs ? m_jobs : std::max( std::thread::hardware_concurrency(), 1u );
+	if ( jobs > vTasks.size() )
+		jobs = std::max( vTasks.size(), static_cast<size_t>(1) );
+
+	std::atomic<size_t> next(0);
+	std::atomic<bool> failed(false);
+
+	auto worker = [&] ( int fd ) {
+		statsScope scope( m_stats );
+		std::vector<char> vBuf( BUFF_SIZE );
+		std::string sPath;
+
+		while ( !failed ) {
+			size_t i = next++;
+			if ( i >= vTasks.size() )
+				break;
+
+			const copyTask_t &task = vTasks[i];
+			const entryTable::entry_t &e = files[task.file];
+			off_t outPos = dataPos + e.offset;
+			uint64_t start = m_trace.enabled() ? m_trace.now() : 0;
+			int method;
+
+			if ( vBaseOffset[task.file] != -1 ) {
+				off_t from = vBaseOffset[task.file];
+				const char *pMap = base->archive.m_pMap;
+
+				method = copyData( base->archive.m_fd, from, fd, outPos, task.size,
+					pMap ? pMap + from : NULL, vBuf.data() );
+
+				if ( method == -1 ) {
+					if ( !failed.exchange(true) ) {
+						sourcePath( sRoot, files, task.file, sPath );
+						std::cerr << "cannot copy file from base archive: " << sPath << std::endl;
+					}
+					break;
+				}
+			} else {
+				sourcePath( sRoot, files, task.file, sPath );
+				int fdIn = ::open( sPath.c_str(), O_RDONLY | O_CLOEXEC );
+				countSyscall( SYSCALL_OPEN );
+
+				if ( fdIn == -1 ) {
+					if ( !failed.exchange(true) )
+						std::cerr << "cannot open file for reading: " << sPath << std::endl;
+					break;
+				}
+
+				method = copyData( fdIn, 0, fd, outPos, e.size, NULL, vBuf.data() );
+				::close(fdIn);
+				countSyscall( SYSCALL_OPEN );
+
+				if ( method == -1 ) {
+					if ( !failed.exchange(true) )
+						std::cerr << "cannot copy file into archive: " << sPath << std::endl;
+					break;
+				}
+			}
+
+			for ( size_t j = task.file; j < task.file + task.count; j++ ) {
+				if ( files[j].type != 'D' && files[j].size > 0 ) {
+					m_stats.copyFiles[method]++;
+					m_stats.copyBytes[method] += files[j].size;
+				}
+			}
+
+			if ( m_trace.enabled() ) {
+				if ( vBaseOffset[task.file] != -1 )
+					sourcePath( sRoot, files, task.file, sPath );
+				m_trace.file( "copy", sPath, task.size, start );
+			}
+		}
+	};
+
+	if ( jobs == 1 ) {
+		worker( fdOut );
+	} else {
+		// sendfile() writes at the file position, so every
+		// thread needs its own open file description
+		std::vector<std::thread> vThreads;
+
+		for ( unsigned i = 0; i < jobs; i++ ) {
+			vThreads.emplace_back( [&] () {
+				int fd = ::open( sArchivePath.c_str(), O_WRONLY | O_CLOEXEC );
+				countSyscall( SYSCALL_OPEN );
+
+				if ( fd == -1 ) {
+					if ( !failed.exchange(true) )
+						perror( sArchivePath.c_str() );
+					return;
+				}
+
+				worker( fd );
+				::close(fd);
+			});
+		}
+
+		for ( auto &t : vThreads )
+			t.join();
+	}
+
+	return !failed;
+}
+#endif  // !_WIN32
+
+// Pack archive
+bool asarArchive::pack(
+	const std::string &sPath,
+	const std::string &sArchivePath,
+	const pathMatcher *unpack,
+	const pathMatcher *unpackDir,
+	bool excludeHidden
+) {
+	entryTable files;
+	std::vector<hashJob_t> vHashJobs;
+	std::vector<std::pair<size_t, size_t>> vDigestCopies;
+	std::string sHeader;
+	scanNode_t root;
+	statsScope scope( m_stats );
+
+	root.path = sPath;
+
+	{
+		traceScope trace( m_trace, "scan" );
+		if ( !scanTree( root, unpack, unpackDir, excludeHidden ) )
+			return false;
+	}
+
+	std::vector<std::pair<size_t, uint32_t>> vOffsetPos;
+
+	createJsonHeader( root, sHeader, files, m_bIntegrity ? &vHashJobs : NULL, vDigestCopies,
+		m_sOrdering.empty() ? NULL : &vOffsetPos );
+
+	if ( m_bDedup ) {
+		std::cerr << "deduplicated " << m_stats.dedupFiles << " files, "
+			<< m_stats.dedupBytes << " bytes saved" << std::endl;
+	}
+
+	if ( !m_sOrdering.empty() && !applyOrdering( files, sHeader, vOffsetPos, vHashJobs, vDigestCopies ) )
+		return false;
+
+	// files that didn't change are copied from the previous archive
+	std::unique_ptr<baseArchive_t> base;
+	std::vector<int64_t> vBaseOffset( files.size(), -1 );
+
+	if ( !m_sBaseArchive.empty() ) {
+		traceScope trace( m_trace, "reuse" );
+		base.reset( new baseArchive_t );
+
+		if ( !base->open(m_sBaseArchive) ||
+				!planReuse( *base, root, files, vHashJobs, sHeader, vBaseOffset ) )
+			return false;
+
+		std::cerr << "reused " << m_stats.reuseFiles << " files (" << m_stats.reuseBytes
+			<< " bytes) from " << m_sBaseArchive << ", read " << m_stats.freshFiles
+			<< " files (" << m_stats.freshBytes << " bytes) from disk" << std::endl;
+	}
+
+	char cHeader[16];
+	sizePickle( cHeader, sHeader.size() );
+
+	// the integrity hashes are computed from the source files on
+	// other threads while the data is copied into the archive
+	std::thread hasher;
+	bool hashOk = true;
+
+	auto joinHasher = [&] () {
+		if ( hasher.joinable() )
+			hasher.join();
+		return hashOk;
+	};
+
+#ifdef _WIN32
+	if ( base && sArchivePath == m_sBaseArchive ) {
+		std::cerr << "output file must not be the base archive: " << sArchivePath << std::endl;
+		return false;
+	}
+
+	std::ofstream ofsOutputFile( sArchivePath, std::ios::binary | std::ios::trunc );
+	if ( !ofsOutputFile.is_open() ) {
+		std::cerr << "cannot open file for writing: " << sArchivePath << std::endl;
+		return false;
+	}
+
+	ofsOutputFile.write( cHeader, 16 );
+	ofsOutputFile << sHeader;
+
+	std::vector<char> fileBuf(BUFF_SIZE);
+	traceScope trace( m_trace, "copy" );
+
+	if ( m_bIntegrity )
+		hasher = std::thread( [&] () { hashOk = hashFiles( files, root.path, vHashJobs, false ); } );
+
+	std::string sPath;
+
+	for (size_t i = 0; i < files.size(); i++) {
+		const entryTable::entry_t &e = files[i];
+
+		if ( e.type == 'D' || e.type == 'L' || e.shared )
+			continue;
+
+		// not in table order with setOrdering()
+		ofsOutputFile.seekp( 16 + sHeader.size() + e.offset );
+		sourcePath( root.path, files, i, sPath );
+
+		if ( vBaseOffset[i] != -1 ) {
+			for ( uint64_t pos = 0; pos < e.size; ) {
+				size_t szChunk = std::min<uint64_t>(e.size - pos, BUFF_SIZE);
+
+				if ( !base->archive.readAt( fileBuf.data(), szChunk, vBaseOffset[i] + pos ) ) {
+					std::cerr << "cannot read file from base archive: " << sPath << std::endl;
+					ofsOutputFile.close();
+					joinHasher();
+					return false;
+				}
+
+				ofsOutputFile.write(fileBuf.data(), szChunk);
+				pos += szChunk;
+			}
+
+			if ( e.size > 0 ) {
+				m_stats.copyFiles[COPY_BUFFERED]++;
+				m_stats.copyBytes[COPY_BUFFERED] += e.size;
+			}
+			continue;
+		}
+
+		std::ifstream ifsFile( sPath, std::ios::binary );
+
+		if ( !ifsFile.is_open() ) {
+			std::cerr << "cannot open file for reading: " << sPath << std::endl;
+			ofsOutputFile.close();
+			joinHasher();
+			return false;
+		}
+
+		uint64_t szFile = e.size;
+
+		while (szFile > 0) {
+			size_t szChunk = std::min<uint64_t>(szFile, BUFF_SIZE);
+			ifsFile.read(fileBuf.data(), szChunk);
+			ofsOutputFile.write(fileBuf.data(), szChunk);
+			szFile -= szChunk;
+		}
+
+		ifsFile.close();
+		if ( e.size > 0 ) {
+			m_stats.copyFiles[COPY_BUFFERED]++;
+			m_stats.copyBytes[COPY_BUFFERED] += e.size;
+		}
+	}
+
+	if ( !joinHasher() )
+		return false;
+
+	if ( m_bIntegrity ) {
+		for ( const auto &job : vHashJobs )
+			sha256::toHex( job.digest, &sHeader[job.pos] );
+		for ( const auto &c : vDigestCopies )
+			memcpy( &sHeader[c.first], &sHeader[c.second], 64 );
+		ofsOutputFile.seekp( 16 );
+		ofsOutputFile << sHeader;
+	}
+
+	ofsOutputFile.close();
+#else
+	// don't truncate the base archive while reading from it, a new
+	// file is written in its place instead
+	struct stat stOut, stBase;
+	if ( base )
+		countSyscall( SYSCALL_STAT );
+	if ( base && ::stat(sArchivePath.c_str(), &stOut) == 0 && fstat(base->archive.m_fd, &stBase) == 0 &&
+			stOut.st_dev == stBase.st_dev && stOut.st_ino == stBase.st_ino &&
+			unlink(sArchivePath.c_str()) != 0 ) {
+		perror( sArchivePath.c_str() );
+		return false;
+	}
+
+	int fdOut = ::open( sArchivePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+	countSyscall( SYSCALL_OPEN );
+	if ( fdOut == -1 ) {
+		std::cerr << "cannot open file for writing: " << sArchivePath << std::endl;
+		return false;
+	}
+
+	if ( !pwriteAll( fdOut, cHeader, 16, 0 ) || !pwriteAll( fdOut, sHeader.data(), sHeader.size(), 16 ) ) {
+		perror( sArchivePath.c_str() );
+		::close(fdOut);
+		return false;
+	}
+
+	if ( m_bIntegrity )
+		hasher = std::thread( [&] () { hashOk = hashFiles( files, root.path, vHashJobs, false ); } );
+
+	{
+		traceScope trace( m_trace, "copy" );
+		if ( !copyPayloads( sArchivePath, fdOut, 16 + sHeader.size(), root.path, files, vBaseOffset, base.get() ) ) {
+			::close(fdOut);
+			joinHasher();
+			return false;
+		}
+	}
+
+	if ( !joinHasher() ) {
+		::close(fdOut);
+		return false;
+	}
+
+	if ( m_bIntegrity ) {
+		for ( const auto &job : vHashJobs )
+			sha256::toHex( job.digest, &sHeader[job.pos] );
+		for ( const auto &c : vDigestCopies )
+			memcpy( &sHeader[c.first], &sHeader[c.second], 64 );
+
+		if ( !pwriteAll( fdOut, sHeader.data(), sHeader.size(), 16 ) ) {
+			perror( sArchivePath.c_str() );
+			::close(fdOut);
+			return false;
+		}
+	}
+
+	countSyscall( SYSCALL_OPEN );
+	if ( ::close(fdOut) != 0 ) {
+		perror( sArchivePath.c_str() );
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+#ifndef _WIN32
+bool asarArchive::unpackToTar( const std::string &sArchivePath, const std::string &sTarPath ) {
+	statsScope scope( m_stats );
+
+	close();
+
+	if ( !openArchive(sArchivePath) )
+		return false;
+
+	entryTable files;
+
+	if ( !streamHeader( files, nullptr, true ) ) {
+		closeArchive();
+		return false;
+	}
+
+	// directories first, then the files in the order of their data
+	// so the archive is read front to back, links last
+	std::vector<uint32_t> vOrder, vLinks;
+
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		if ( files[i].type == 'D' )
+			vOrder.push_back( i );
+	}
+
+	size_t firstFile = vOrder.size();
+
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		if ( files[i].type == 'L' )
+			vLinks.push_back( i );
+		else if ( files[i].type != 'D' )
+			vOrder.push_back( i );
+	}
+
+	std::stable_sort( vOrder.begin() + firstFile, vOrder.end(), [&files] (uint32_t a, uint32_t b) {
+		return files[a].offset < files[b].offset;
+	});
+	vOrder.insert( vOrder.end(), vLinks.begin(), vLinks.end() );
+
+	int fdOut = STDOUT_FILENO;
+
+	if ( sTarPath != "-" ) {
+		fdOut = ::open( sTarPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+		countSyscall( SYSCALL_OPEN );
+		if ( fdOut == -1 ) {
+			std::cerr << "cannot open file for writing: " << sTarPath << std::endl;
+			closeArchive();
+			return false;
+		}
+	}
+
+	// the entries get the time of the archive
+	struct stat st;
+	int64_t mtime = 0;
+	countSyscall( SYSCALL_STAT );
+	if ( ::fstat(m_fd, &st) == 0 )
+		mtime = st.st_mtime;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	::posix_fadvise( m_fd, m_headerSize, 0, POSIX_FADV_SEQUENTIAL );
+	countSyscall( SYSCALL_CACHE );
+#endif
+
+	traceScope trace( m_trace, "tar" );
+
+	// headers and small files are collected and written BUFF_SIZE
+	// bytes at a time, bigger files straight from the archive
+	std::string sOut, sPath;
+	std::vector<char> vBuf;
+	bool ok = true;
+
+	sOut.reserve( BUFF_SIZE + COALESCE_MAX_FILE + 4 * TAR_BLOCK );
+
+	auto flush = [&] () {
+		ok = ok && writeAll( fdOut, sOut.data(), sOut.size() );
+		sOut.clear();
+	};
+
+	for ( size_t k = 0; k < vOrder.size() && ok; k++ ) {
+		uint32_t i = vOrder[k];
+		const entryTable::entry_t &e = files[i];
+
+		sPath.clear();
+		files.appendPath( i, sPath );
+		tarWriter::header( sOut, sPath, e.type, e.size, files.link(i), mtime );
+
+		if ( e.type == 'D' ) {
+			m_stats.dirs++;
+		} else if ( e.type == 'L' ) {
+			m_stats.links++;
+		} else {
+			m_stats.files++;
+
+			for ( uint64_t pos = 0; pos < e.size && ok; ) {
+				size_t n = std::min<uint64_t>( e.size - pos, BUFF_SIZE );
+				const char *pData;
+
+				if ( !getView( m_headerSize + e.offset + pos, n, pData, vBuf ) ) {
+					std::cerr << "cannot read file from archive: " << sPath << std::endl;
+					ok = false;
+					break;
+				}
+
+				if ( e.size <= COALESCE_MAX_FILE ) {
+					sOut.append( pData, n );
+				} else {
+					flush();
+					ok = ok && writeAll( fdOut, pData, n );
+				}
+				pos += n;
+			}
+
+			sOut.append( tarWriter::padding(e.size), 0 );
+			m_stats.copyFiles[COPY_BUFFERED]++;
+			m_stats.copyBytes[COPY_BUFFERED] += e.size;
+		}
+
+		if ( sOut.size() >= BUFF_SIZE )
+			flush();
+	}
+
+	if ( ok ) {
+		tarWriter::end( sOut );
+		flush();
+		if ( !ok )
+			perror( sTarPath == "-" ? "stdout" : sTarPath.c_str() );
+	}
+
+	if ( fdOut != STDOUT_FILENO ) {
+		countSyscall( SYSCALL_OPEN );
+		if ( ::close(fdOut) != 0 && ok ) {
+			perror( sTarPath.c_str() );
+			ok = false;
+		}
+	}
+
+	closeArchive();
+
+	return ok;
+}
+
+// Data of the files of pack from tar until the header is written: the
+// first TAR_STAGING_MEMORY bytes in memory, after that in an unlinked
+// file next to the archive. A file is either all in memory or all in the
+// file, positions past mem.size() are in the file.
+struct asarArchive::tarStaging_t {
+	std::vector<char> mem;
+	int fd = -1;
+	uint64_t fileSize = 0;
+
+	~tarStaging_t() {
+		if ( fd != -1 )
+			::close(fd);
+	}
+
+	uint64_t size() const { return mem.size() + fileSize; }
+
+	bool createFile( const std::string &sArchivePath ) {
+		std::string sDir( sArchivePath );
+		size_t pos = sDir.find_last_of( DIR_SEPARATORS );
+		sDir = ( pos == std::string::npos ) ? "." : sDir.substr( 0, pos + 1 );
+
+		countSyscall( asarArchive::SYSCALL_OPEN );
+#ifdef O_TMPFILE
+		fd = ::open( sDir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600 );
+		if ( fd != -1 )
+			return true;
+#endif
+		std::string sTemp = sDir + "/.asar-tar-XXXXXX";
+		fd = ::mkstemp( &sTemp[0] );
+		if ( fd == -1 ) {
+			perror( sTemp.c_str() );
+			return false;
+		}
+		::unlink( sTemp.c_str() );
+		return true;
+	}
+};
+
+bool asarArchive::packFromTar(
+	const std::string &sTarPath,
+	const std::string &sArchivePath,
+	const pathMatcher *unpack,
+	const pathMatcher *unpackDir,
+	bool excludeHidden
+) {
+	statsScope scope( m_stats );
+
+	if ( !m_sBaseArchive.empty() ) {
+		std::cerr << "a base archive cannot be used with a tar file" << std::endl;
+		return false;
+	}
+
+	if ( unpack && unpack->empty() )
+		unpack = NULL;
+	if ( unpackDir && unpackDir->empty() )
+		unpackDir = NULL;
+
+	int fdIn = STDIN_FILENO;
+
+	if ( sTarPath != "-" ) {
+		fdIn = ::open( sTarPath.c_str(), O_RDONLY | O_CLOEXEC );
+		countSyscall( SYSCALL_OPEN );
+		if ( fdIn == -1 ) {
+			perror( sTarPath.c_str() );
+			return false;
+		}
+	}
+
+	// The tree of the entries, nodes refer to their children by index
+	// into vNodes as it grows; node 0 is the root. It becomes a scanNode_t
+	// tree like scanTree() reads from disk.
+	typedef struct {
+		scanNode_t node;  // without children
+		std::map<std::string, size_t> children;  // sorted by name like scanTree() does
+	} tarNode_t;
+
+	std::vector<tarNode_t> vNodes( 1 );
+	std::unique_ptr<tarStaging_t> staging( new tarStaging_t );
+	tarReader reader( fdIn );
+	tarReader::entry_t e;
+	std::vector<char> vBuf( BUFF_SIZE );
+	bool ok = true;
+
+	vNodes[0].node.type = 'D';
+	staging->mem.reserve( TAR_STAGING_MEMORY );
+
+	// node of path, created with its directories if bCreate, 0 if it is left out
+	auto lookup = [&] ( const std::string &sPath, bool bCreate ) -> size_t {
+		size_t cur = 0;
+		size_t pos = 0;
+
+		while ( pos < sPath.size() ) {
+			size_t end = sPath.find( '/', pos );
+			if ( end == std::string::npos )
+				end = sPath.size();
+
+			std::string sName = sPath.substr( pos, end - pos );
+			bool bLast = ( end == sPath.size() );
+
+			if ( sName == ".." || (excludeHidden && sName[0] == '.') )
+				return 0;
+			if ( !bLast && unpackDir && unpackDir->match( sPath.c_str(), end ) )
+				return 0;
+
+			auto it = vNodes[cur].children.find( sName );
+			size_t next;
+
+			if ( it != vNodes[cur].children.end() ) {
+				next = it->second;
+			} else if ( bCreate ) {
+				next = vNodes.size();
+				vNodes.emplace_back();
+				vNodes[next].node.name = sName;
+				vNodes[next].node.type = 'D';
+				vNodes[next].node.size = 0;
+				vNodes[next].node.hidden = false;
+				vNodes[next].node.mtime = -1;
+				vNodes[cur].children[sName] = next;
+			} else {
+				return 0;
+			}
+
+			if ( !bLast && vNodes[next].node.type != 'D' ) {
+				std::cerr << "not a directory in tar stream: " << sPath.substr( 0, end ) << std::endl;
+				return 0;
+			}
+
+			cur = next;
+			pos = end + 1;
+		}
+
+		return cur;
+	};
+
+	{
+		traceScope trace( m_trace, "read tar" );
+
+		while ( ok && reader.next(e) ) {
+			if ( e.path.empty() )
+				continue;
+
+			if ( e.type == 0 ) {
+				std::cerr << "skipping special file in tar stream: " << e.path << std::endl;
+				continue;
+			}
+
+			if ( e.type == 'D' ? (unpackDir && unpackDir->match(e.path)) : (unpack && unpack->match(e.path)) )
+				continue;
+
+			// a hard link gets the data of the entry it refers to, with
+			// --dedup it shares it like hard links on disk by a made up inode
+			size_t target = 0;
+
+			if ( e.type == 'H' ) {
+				target = lookup( e.link, false );
+				if ( target == 0 || (vNodes[target].node.type != 'F' && vNodes[target].node.type != 'X') ) {
+					std::cerr << "skipping hard link to a missing file in tar stream: " << e.path << std::endl;
+					continue;
+				}
+			}
+
+			size_t index = lookup( e.path, true );
+			if ( index == 0 )
+				continue;
+
+			scanNode_t &node = vNodes[index].node;
+
+			if ( e.type == 'D' || target == index )
+				continue;
+
+			// a later entry replaces an earlier one
+			vNodes[index].children.clear();
+			node.link_target.clear();
+			node.hashed = false;
+			node.size = 0;
+			node.staged = -1;
+			node.ino = 0;
+
+			if ( target ) {
+				scanNode_t &t = vNodes[target].node;
+				if ( m_bDedup ) {
+					if ( t.ino == 0 )
+						t.ino = target;
+					node.ino = t.ino;
+				}
+				node.type = t.type;
+				node.size = t.size;
+				node.staged = t.staged;
+				node.hashed = t.hashed;
+				memcpy( node.digest, t.digest, 32 );
+				continue;
+			}
+
+			node.type = e.type;
+
+			if ( e.type == 'L' ) {
+				node.link_target = e.link;
+				continue;
+			}
+
+			node.size = e.size;
+			node.staged = staging->size();
+
+			sha256 hash;
+			bool bHash = ( m_bDedup && e.size > 0 );
+
+			if ( staging->fd == -1 && e.size <= TAR_STAGING_MEMORY - staging->mem.size() ) {
+				size_t pos = staging->mem.size();
+				staging->mem.resize( pos + e.size );
+				ok = reader.read( staging->mem.data() + pos, e.size );
+				if ( bHash )
+					hash.update( staging->mem.data() + pos, e.size );
+			} else {
+				if ( staging->fd == -1 && !staging->createFile( sArchivePath ) ) {
+					ok = false;
+					break;
+				}
+
+				for ( uint64_t pos = 0; pos < e.size && ok; ) {
+					size_t n = std::min<uint64_t>( e.size - pos, BUFF_SIZE );
+
+					ok = reader.read( vBuf.data(), n ) &&
+						pwriteAll( staging->fd, vBuf.data(), n, staging->fileSize + pos );
+					if ( bHash )
+						hash.update( vBuf.data(), n );
+					pos += n;
+				}
+
+				if ( !ok && reader.error().empty() )
+					perror( "temporary file" );
+				staging->fileSize += e.size;
+			}
+
+			if ( bHash ) {
+				hash.final( node.digest );
+				node.hashed = true;
+			}
+		}
+
+		if ( !reader.error().empty() ) {
+			std::cerr << ( sTarPath == "-" ? "stdin" : sTarPath ) << ": " << reader.error() << std::endl;
+			ok = false;
+		}
+	}
+
+	if ( fdIn != STDIN_FILENO ) {
+		::close( fdIn );
+		countSyscall( SYSCALL_OPEN );
+	}
+
+	if ( !ok )
+		return false;
+
+	// build the scanNode_t tree, children in name order
+	std::function<void(size_t, scanNode_t &)> build = [&] ( size_t index, scanNode_t &dir ) {
+		dir.children.reserve( vNodes[index].children.size() );
+		for ( const auto &c : vNodes[index].children ) {
+			dir.children.push_back( std::move(vNodes[c.second].node) );
+			if ( dir.children.back().type == 'D' )
+				build( c.second, dir.children.back() );
+		}
+	};
+
+	scanNode_t root = std::move( vNodes[0].node );
+	build( 0, root );
+	vNodes.clear();
+
+	entryTable files;
+	std::vector<hashJob_t> vHashJobs;
+	std::vector<std::pair<size_t, size_t>> vDigestCopies;
+	std::string sHeader;
+
+	std::vector<std::pair<size_t, uint32_t>> vOffsetPos;
+
+	createJsonHeader( root, sHeader, files, m_bIntegrity ? &vHashJobs : NULL, vDigestCopies,
+		m_sOrdering.empty() ? NULL : &vOffsetPos );
+
+	if ( m_bDedup ) {
+		std::cerr << "deduplicated " << m_stats.dedupFiles << " files, "
+			<< m_stats.dedupBytes << " bytes saved" << std::endl;
+	}
+
+	if ( !m_sOrdering.empty() && !applyOrdering( files, sHeader, vOffsetPos, vHashJobs, vDigestCopies ) )
+		return false;
+
+	// staging positions in the order of the entry table
+	std::vector<int64_t> vStaged;
+	vStaged.reserve( files.size() );
+
+	std::function<void(const scanNode_t &)> collect = [&] ( const scanNode_t &dir ) {
+		for ( const auto &c : dir.children ) {
+			vStaged.push_back( c.staged );
+			if ( c.type == 'D' )
+				collect( c );
+		}
+	};
+	collect( root );
+
+	char cHeader[16];
+	sizePickle( cHeader, sHeader.size() );
+
+	int fdOut = ::open( sArchivePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+	countSyscall( SYSCALL_OPEN );
+	if ( fdOut == -1 ) {
+		std::cerr << "cannot open file for writing: " << sArchivePath << std::endl;
+		return false;
+	}
+
+	off_t dataPos = 16 + sHeader.size();
+
+	ok = pwriteAll( fdOut, cHeader, 16, 0 ) && pwriteAll( fdOut, sHeader.data(), sHeader.size(), 16 );
+
+	{
+		traceScope trace( m_trace, "copy" );
+		const uint64_t memSize = staging->mem.size();
+
+		for ( size_t i = 0; i < files.size() && ok; i++ ) {
+			const entryTable::entry_t &f = files[i];
+
+			if ( f.type == 'D' || f.type == 'L' || f.shared || f.size == 0 )
+				continue;
+
+			uint64_t from = vStaged[i];
+			int method = COPY_BUFFERED;
+
+			if ( from < memSize ) {
+				ok = pwriteAll( fdOut, staging->mem.data() + from, f.size, dataPos + f.offset );
+			} else {
+				method = copyData( staging->fd, from - memSize, fdOut, dataPos + f.offset, f.size, NULL, vBuf.data() );
+				ok = ( method != -1 );
+			}
+
+			if ( ok ) {
+				m_stats.copyFiles[method]++;
+				m_stats.copyBytes[method] += f.size;
+			}
+		}
+	}
+
+	if ( !ok )
+		perror( sArchivePath.c_str() );
+
+	staging.reset();
+
+	// hashed from the archive just written
+	if ( ok && m_bIntegrity ) {
+		ok = openArchive( sArchivePath );
+		if ( ok ) {
+			m_headerSize = dataPos;
+			ok = hashFiles( files, "", vHashJobs, true );
+			closeArchive();
+		}
+
+		if ( ok ) {
+			for ( const auto &job : vHashJobs )
+				sha256::toHex( job.digest, &sHeader[job.pos] );
+			for ( const auto &c : vDigestCopies )
+				memcpy( &sHeader[c.first], &sHeader[c.second], 64 );
+
+			ok = pwriteAll( fdOut, sHeader.data(), sHeader.size(), 16 );
+			if ( !ok )
+				perror( sArchivePath.c_str() );
+		}
+	}
+
+	countSyscall( SYSCALL_OPEN );
+	if ( ::close(fdOut) != 0 && ok ) {
+		perror( sArchivePath.c_str() );
+		ok = false;
+	}
+
+	return ok;
+}
+#else
+bool asarArchive::unpackToTar( const std::string &, const std::string & ) {
+	std::cerr << "tar streams are not supported on Windows" << std::endl;
+	return false;
+}
+
+bool asarArchive::packFromTar( const std::string &, const std::string &, const pathMatcher *, const pathMatcher *, bool ) {
+	std::cerr << "tar streams are not supported on Windows" << std::endl;
+	return false;
+}
+#endif  // !_WIN32
+
+// List archive content
+bool asarArchive::list( const std::string &sArchivePath ) {
+	return unpack( sArchivePath, "", "" );
+}
+
+static const char *syscallNames[asarArchive::SYSCALL_KINDS] = {
+	"open", "stat", "read", "write", "copy", "mkdir", "readdir", "cache", "io_uring"
+};
+
+void asarArchive::printStats( std::ostream &os ) const {
+	static const char *methods[COPY_METHODS] = {
+		"copy_file_range", "sendfile", "mmap", "buffered", "io_uring"
+	};
+
+	os << "entries: " << m_stats.files << " files, " << m_stats.links << " links, "
+		<< m_stats.dirs << " directories" << std::endl;
+	os << "I/O: " << m_stats.bytesRead << " bytes read, " << m_stats.bytesWritten << " bytes written" << std::endl;
+
+	os << "system calls:";
+	for ( int i = 0; i < SYSCALL_KINDS; i++ )
+		os << ' ' << syscallNames[i] << ' ' << m_stats.syscalls[i];
+	os << std::endl;
+
+	os << "data copy paths:" << std::endl;
+	for ( int i = 0; i < COPY_METHODS; i++ ) {
+		os << "  " << methods[i] << ": " << m_stats.copyFiles[i] << " files, "
+			<< m_stats.copyBytes[i] << " bytes" << std::endl;
+	}
+
+	if ( m_stats.cacheHits + m_stats.cacheMisses > 0 ) {
+		os << "file cache: " << m_stats.cacheHits << " hits, "
+			<< m_stats.cacheMisses << " misses" << std::endl;
+	}
+
+	if ( m_stats.headerBytes > 0 ) {
+		os << "header: " << m_stats.headerBytes << " bytes in "
+			<< m_stats.headerNanos / 1e9 << " s" << std::endl;
+	}
+
+	if ( m_stats.reuseFiles + m_stats.freshFiles > 0 ) {
+		os << "base archive: reused " << m_stats.reuseFiles << " files, " << m_stats.reuseBytes
+			<< " bytes; read " << m_stats.freshFiles << " files, " << m_stats.freshBytes << " bytes" << std::endl;
+	}
+
+	if ( m_stats.dedupFiles > 0 ) {
+		os << "deduplication: " << m_stats.dedupFiles << " files, "
+			<< m_stats.dedupBytes << " bytes saved" << std::endl;
+	}
+
+	if ( m_stats.hashBytes > 0 )
+		printHashStats( os );
+
+	// wall time, phases can overlap or run more than once
+	std::vector<traceLog::phaseTotal_t> vPhases = m_trace.phases();
+
+	if ( !vPhases.empty() ) {
+		os << "phases:" << std::endl;
+		for ( const auto &p : vPhases ) {
+			os << "  " << p.name << ": " << p.nanos / 1e9 << " s";
+			if ( p.count > 1 )
+				os << " (" << p.count << " times)";
+			os << std::endl;
+		}
+	}
+
+	std::vector<traceLog::fileTime_t> vSlowest = m_trace.slowest();
+
+	if ( !vSlowest.empty() ) {
+		os << "slowest files:" << std::endl;
+		for ( const auto &f : vSlowest ) {
+			os << "  " << f.nanos / 1e9 << " s, " << f.size << " bytes, "
+				<< f.cat << ": " << f.path << std::endl;
+		}
+	}
+}
+
+// Write the events recorded with setTrace(true) as Chrome trace
+bool asarArchive::writeTrace( const std::string &sPath ) const {
+	std::vector<std::pair<const char *, uint64_t>> vCounters;
+
+	for ( int i = 0; i < SYSCALL_KINDS; i++ )
+		vCounters.emplace_back( syscallNames[i], m_stats.syscalls[i].load() );
+	vCounters.emplace_back( "bytes read", m_stats.bytesRead.load() );
+	vCounters.emplace_back( "bytes written", m_stats.bytesWritten.load() );
+
+	if ( !m_trace.writeChrome( sPath, vCounters ) ) {
+		std::cerr << "cannot write trace: " << sPath << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void asarArchive::printHashStats( std::ostream &os ) const {
+	double seconds = m_stats.hashNanos / 1e9;
+
+	os << "sha256 (" << sha256::implementation() << "): " << m_stats.hashBytes << " bytes in "
+		<< seconds << " s, " << (seconds > 0 ? m_stats.hashBytes / seconds / 1e9 : 0) << " GB/s" << std::endl;
+}
+
+// Compute the digests of vJobs on m_jobs threads, the data is read from
+// the source files below sRoot (pack) or from the archive opened by
+// openArchive()
+bool asarArchive::hashFiles( const entryTable &files, const std::string &sRoot, std::vector<hashJob_t> &vJobs, bool bFromArchive ) {
+	auto start = std::chrono::steady_clock::now();
+	traceScope trace( m_trace, "hash" );
+
+	// biggest ranges first, so a large file isn't left for the end
+	std::vector<size_t> vOrder( vJobs.size() );
+	std::iota( vOrder.begin(), vOrder.end(), 0 );
+	std::stable_sort( vOrder.begin(), vOrder.end(), [&vJobs] (size_t a, size_t b) {
+		return vJobs[a].size > vJobs[b].size;
+	});
+
+	unsigned jobs = m_jobs ? m_jobs : std::max( std::thread::hardware_concurrency(), 1u );
+	if ( jobs > vJobs.size() )
+		jobs = std::max( vJobs.size(), static_cast<size_t>(1) );
+
+	std::atomic<size_t> next(0);
+	std::atomic<bool> failed(false);
+
+	auto worker = [&] () {
+		statsScope scope( m_stats );
+		std::vector<char> vBuf;
+		std::string sPath;
+		sha256 ctx;
+
+		while ( !failed ) {
+			size_t i = next++;
+			if ( i >= vOrder.size() )
+				break;
+
+			hashJob_t &job = vJobs[ vOrder[i] ];
+			const entryTable::entry_t &file = files[job.file];
+			uint64_t pos = 0;
+
+			if ( bFromArchive ) {
+				while ( pos < job.size ) {
+					size_t n = std::min<uint64_t>( job.size - pos, BUFF_SIZE );
+					const char *pData;
+
+					if ( !getView( m_headerSize + file.offset + job.offset + pos, n, pData, vBuf ) ) {
+						std::cerr << "cannot read file from archive: " << files.path(job.file) << std::endl;
+						failed = true;
+						break;
+					}
+
+					ctx.update( pData, n );
+					pos += n;
+				}
+			} else {
+				vBuf.resize( BUFF_SIZE );
+				sourcePath( sRoot, files, job.file, sPath );
+#ifdef _WIN32
+				std::ifstream ifsFile( sPath, std::ios::binary );
+				ifsFile.seekg( job.offset );
+#else
+				int fd = ::open( sPath.c_str(), O_RDONLY | O_CLOEXEC );
+				countSyscall( SYSCALL_OPEN );
+#endif
+				while ( pos < job.size ) {
+					size_t n = std::min<uint64_t>( job.size - pos, BUFF_SIZE );
+#ifdef _WIN32
+					bool ok = ifsFile.read( vBuf.data(), n ).good();
+#else
+					bool ok = ( fd != -1 && preadAll( fd, vBuf.data(), n, job.offset + pos ) );
+#endif
+					if ( !ok ) {
+						std::cerr << "cannot read file: " << sPath << std::endl;
+						failed = true;
+						break;
+					}
+
+					ctx.update( vBuf.data(), n );
+					pos += n;
+				}
+#ifndef _WIN32
+				if ( fd != -1 ) {
+					::close(fd);
+					countSyscall( SYSCALL_OPEN );
+				}
+#endif
+			}
+
+			ctx.final( job.digest );
+			m_stats.hashBytes += pos;
+		}
+	};
+
+	if ( jobs == 1 ) {
+		worker();
+	} else {
+		std::vector<std::thread> vThreads;
+		for ( unsigned i = 0; i < jobs; i++ )
+			vThreads.emplace_back(worker);
+		for ( auto &t : vThreads )
+			t.join();
+	}
+
+	m_stats.hashNanos += std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+
+	return !failed;
+}
+
+// Check the integrity hashes of all packed files
+bool asarArchive::verify( const std::string &sArchivePath ) {
+	statsScope scope( m_stats );
+
+	close();
+
+	if ( !openArchive(sArchivePath) )
+		return false;
+
+	headerDom_t dom;
+	entryTable files;
+	std::vector<const rapidjson::Value *> vIntegrity;
+
+	bool ok = loadHeader(dom);
+
+	if ( ok ) {
+		traceScope trace( m_trace, "index" );
+		ok = ( getFiles( (*dom.json)["files"], files, entryTable::NONE, &vIntegrity ) != -1 );
+	}
+
+	if ( !ok ) {
+		closeArchive();
+		return false;
+	}
+
+	std::vector<hashJob_t> vJobs;
+	size_t checked = 0;
+	size_t errors = 0;
+
+	for ( size_t i = 0; i < files.size(); i++ ) {
+		const entryTable::entry_t &e = files[i];
+
+		if ( e.type != 'F' && e.type != 'X' )
+			continue;
+
+		const rapidjson::Value *v = vIntegrity[i];
+		size_t blockSize = 0;
+
+		if ( v && v->HasMember("algorithm") && (*v)["algorithm"].IsString() &&
+				strcmp( (*v)["algorithm"].GetString(), "SHA256" ) == 0 &&
+				v->HasMember("hash") && (*v)["hash"].IsString() &&
+				(*v)["hash"].GetStringLength() == 64 &&
+				v->HasMember("blockSize") && (*v)["blockSize"].IsUint() &&
+				v->HasMember("blocks") && (*v)["blocks"].IsArray() )
+			blockSize = (*v)["blockSize"].GetUint();
+
+		// upstream adds an empty last block when the size is a multiple
+		// of the block size, accept archives without it too
+		size_t numBlocks = blockSize ? (*v)["blocks"].Size() : 0;
+
+		if ( blockSize == 0 || ( numBlocks != e.size / blockSize + 1 && numBlocks != (e.size + blockSize - 1) / blockSize ) ) {
+			std::cerr << "no valid integrity data: " << files.path(i) << std::endl;
+			errors++;
+			continue;
+		}
+
+		hashJob_t job;
+		job.file = i;
+		job.offset = 0;
+		job.size = e.size;
+		job.block = -1;
+		job.pos = 0;
+		job.expected = (*v)["hash"].GetString();
+		vJobs.push_back(job);
+
+		for ( size_t b = 0; b < numBlocks; b++ ) {
+			const rapidjson::Value &block = (*v)["blocks"][b];
+
+			if ( !block.IsString() || block.GetStringLength() != 64 ) {
+				std::cerr << "no valid integrity data: " << files.path(i) << std::endl;
+				errors++;
+				break;
+			}
+
+			job.offset = b * blockSize;
+			job.size = std::min<uint64_t>( e.size - job.offset, blockSize );
+			job.block = b;
+			job.expected = block.GetString();
+			vJobs.push_back(job);
+		}
+
+		checked++;
+	}
+
+	bool ret = hashFiles( files, "", vJobs, true );
+
+	for ( const auto &job : vJobs ) {
+		char hex[64];
+		sha256::toHex( job.digest, hex );
+
+		if ( ret && memcmp( hex, job.expected, 64 ) != 0 ) {
+			std::cerr << "integrity mismatch: " << files.path(job.file);
+			if ( job.block != -1 )
+				std::cerr << " (block " << job.block << ")";
+			std::cerr << std::endl;
+			errors++;
+		}
+	}
+
+	closeArchive();
+
+	std::cout << checked << " files checked, " << errors << " errors" << std::endl;
+	printHashStats( std::cout );
+
+	return ret && errors == 0;
+}
+
+// Extract single files into the current directory, named by their basename.
+// All files are looked up in the path index first and then written in
+// one pass ordered by their offset in the archive.
+bool asarArchive::extractFiles( const std::string &sArchivePath, const std::vector<std::string> &vFiles ) {
+	statsScope scope( m_stats );
+
+	if ( !open(sArchivePath) )
+		return false;
+
+	std::vector<uint32_t> vSelected;
+	bool ret = true;
+
+	vSelected.reserve( vFiles.size() );
+
+	for ( const auto &f : vFiles ) {
+		uint32_t i = findEntry( f );
+
+		if ( i == entryTable::NONE ) {
+			std::cerr << "file not found in archive: " << f << std::endl;
+			ret = false;
+			continue;
+		}
+		vSelected.push_back( i );
+	}
+
+	auto byOffset = [this] (uint32_t a, uint32_t b) {
+		return m_entries[a].offset < m_entries[b].offset;
+	};
+	std::stable_sort( vSelected.begin(), vSelected.end(), byOffset );
+
+	std::vector<char> fileBuf(BUFF_SIZE);
+
+	for ( const auto i : vSelected ) {
+		// basename
+		if ( !unpackSingleFile( m_entries, i, m_entries.name(i), fileBuf.data() ) ) {
+			ret = false;
+			break;
+		}
+	}
+
+	close();
+
+	return ret;
+}
+
+#ifndef _WIN32
+// Start of an index file, the image of the entry table follows. The
+// index belongs to the archive with the JSON header of digest; as long
+// as the stat() fields are the same it is used without reading the
+// header. Numbers are in native byte order.
+typedef struct {
+	char magic[8];        // INDEX_MAGIC
+	uint32_t byteOrder;   // INDEX_BYTE_ORDER
+	uint32_t jsonSize;    // bytes of the JSON header
+	uint64_t headerSize;  // payloads start here
+	uint64_t archiveSize;
+	int64_t mtime, mtimeNs;
+	int64_t ctime, ctimeNs;
+	uint64_t dev, ino;
+	uint8_t digest[32];   // SHA-256 of the JSON header
+} indexHeader_t;
+
+static void indexStat( indexHeader_t &h, const struct stat &st ) {
+#ifdef __APPLE__
+	const struct timespec &mtim = st.st_mtimespec, &ctim = st.st_ctimespec;
+#else
+	const struct timespec &mtim = st.st_mtim, &ctim = st.st_ctim;
+#endif
+	h.archiveSize = st.st_size;
+	h.mtime = mtim.tv_sec;
+	h.mtimeNs = mtim.tv_nsec;
+	h.ctime = ctim.tv_sec;
+	h.ctimeNs = ctim.tv_nsec;
+	h.dev = st.st_dev;
+	h.ino = st.st_ino;
+}
+
+std::string asarArchive::indexPath( const std::string &sArchivePath ) const {
+	if ( m_sIndexDir.empty() )
+		return sArchivePath + ".idx";
+
+	// named by the hash of the absolute path of the archive
+	char *real = realpath( sArchivePath.c_str(), NULL );
+	std::string sReal = real ? real : sArchivePath;
+	uint8_t digest[32];
+	char hex[64];
+
+	free( real );
+	sha256::hash( sReal.data(), sReal.size(), digest );
+	sha256::toHex( digest, hex );
+
+	std::string sPath( m_sIndexDir );
+	if ( !IS_DIR_SEPARATOR( sPath.back() ) )
+		sPath.push_back( '/' );
+	return sPath.append( hex, 64 ).append( ".idx" );
+}
+
+// Replace files with the index of the archive opened by openArchive() if
+// there is one and it is up to date. An archive that was only touched or
+// copied is recognized by its header, its index is then updated.
+bool asarArchive::loadIndex( const std::string &sArchivePath, entryTable &files ) {
+	traceScope trace( m_trace, "load index" );
+	int fd = ::open( indexPath(sArchivePath).c_str(), O_RDONLY | O_CLOEXEC );
+	countSyscall( SYSCALL_OPEN );
+
+	if ( fd == -1 )
+		return false;
+
+	struct stat st, stIndex;
+	const char *pIndex = NULL;
+	size_t size = 0;
 
+	countSyscall( SYSCALL_STAT );
+	countSyscall( SYSCALL_STAT );
+	if ( ::fstat(m_fd, &st) == 0 && ::fstat(fd, &stIndex) == 0 && stIndex.st_size > (off_t) sizeof(indexHeader_t) ) {
+		void *p = ::mmap(NULL, stIndex.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( p != MAP_FAILED ) {
+			pIndex = static_cast<const char *>(p);
+			size = stIndex.st_size;
+		}
+	}
 
-bool asarArchive::createJsonHeader(
-		const std::string &sPath,
-		std::string &sHeader,
-		size_t &szOffset,
-		std::vector<fileEntry_t> &vFileList,
-		const char *unpack,
-		const char *unpackDir,
-		bool excludeHidden
-) {
-	DIR* dir = opendir( sPath.c_str() );
-	if ( !dir ) {
-		perror(sPath.c_str());
+	::close( fd );
+	countSyscall( SYSCALL_OPEN );
+
+	if ( !pIndex )
 		return false;
-	}
 
-	struct dirent* file;
-	std::vector<std::string> entries;
+	indexHeader_t h, cur;
+	memcpy( &h, pIndex, sizeof(h) );
+	memcpy( &cur, &h, sizeof(h) );
+	indexStat( cur, st );
 
-	while ( (file = readdir(dir)) ) {
-		const char *p = file->d_name;
+	bool ok = ( memcmp(h.magic, INDEX_MAGIC, 8) == 0 && h.byteOrder == INDEX_BYTE_ORDER && h.archiveSize == cur.archiveSize &&
+		h.headerSize <= h.archiveSize );
+	bool bChanged = ( memcmp(&h, &cur, sizeof(h)) != 0 );
 
-		// ignore "." and ".."
-		if ( p[0] == '.' ) {
-#ifndef _WIN32
-			if (excludeHidden)
-				continue;
-#endif
-			if ( p[1] == 0 || (p[1] == '.' && p[2] == 0) )
-				continue;
-		}
+	if ( ok && bChanged ) {
+		const char *pHeader;
+		uint32_t uSize;
+		std::vector<char> vBuf;
+		uint8_t digest[32];
 
-		entries.push_back(p);
+		ok = ( findHeader( pHeader, uSize, vBuf ) && uSize == h.jsonSize && m_headerSize == h.headerSize );
+		if ( ok ) {
+			sha256::hash( pHeader, uSize, digest );
+			ok = ( memcmp( digest, h.digest, 32 ) == 0 );
+		}
 	}
 
-	std::sort(entries.begin(), entries.end());
+	if ( ok ) {
+		m_headerSize = h.headerSize;
+		ok = files.load( pIndex + sizeof(h), size - sizeof(h) );
+	}
 
-	for ( const auto &e : entries ) {
-		std::string sLocalPath = sPath + "/" + e;
-#ifdef _WIN32
-		bool attrHidden = false;
-		DWORD res = GetFileAttributesA(sLocalPath.c_str());
-		if ( res != INVALID_FILE_ATTRIBUTES && (res & FILE_ATTRIBUTE_HIDDEN) )
-			attrHidden = true;
+	::munmap( const_cast<char *>(pIndex), size );
 
-		if (excludeHidden && attrHidden)
-			continue;
-#endif
+	if ( ok && bChanged )
+		saveIndex( sArchivePath, files );
 
-		DIR* isDir = opendir( sLocalPath.c_str() );
+	return ok;
+}
 
-		if ( isDir ) {
-			closedir( isDir );
+// Write the index of the archive opened by openArchive(), files must have
+// the path index. It goes to a temporary file that is renamed, readers see
+// the old index or the new one; if it can't be written there is none.
+void asarArchive::saveIndex( const std::string &sArchivePath, const entryTable &files ) {
+	traceScope trace( m_trace, "save index" );
+	indexHeader_t h;
+	struct stat st;
+	const char *pHeader;
+	uint32_t uSize;
+	std::vector<char> vBuf;
 
-			if ( unpackDir && std::regex_match(sLocalPath, std::regex(unpackDir)) )
-				continue;
+	countSyscall( SYSCALL_STAT );
+	if ( ::fstat(m_fd, &st) != 0 || !findHeader( pHeader, uSize, vBuf ) )
+		return;
 
-			sHeader += "\"" + e + "\":{\"files\":{";
-			createJsonHeader( sLocalPath, sHeader, szOffset, vFileList, unpack, unpackDir, excludeHidden );
-			sHeader.pop_back();  // remove trailing comma
-			sHeader += "}}";
-		} else {
-			if ( unpack && std::regex_match(sLocalPath, std::regex(unpack)) )
-				continue;
+	memset( &h, 0, sizeof(h) );
+	memcpy( h.magic, INDEX_MAGIC, 8 );
+	h.byteOrder = INDEX_BYTE_ORDER;
+	h.jsonSize = uSize;
+	h.headerSize = m_headerSize;
+	indexStat( h, st );
+	sha256::hash( pHeader, uSize, h.digest );
 
-			fileEntry_t entry;
-#ifdef _WIN32
-			HANDLE hFile = CreateFile(sLocalPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL);
-			if ( hFile == INVALID_HANDLE_VALUE ) {
-				std::cerr << "cannot open file for reading: " << sLocalPath << std::endl;
-				closedir(dir);
-				return false;
-			}
+	std::string sData( reinterpret_cast<const char *>(&h), sizeof(h) );
+	files.serialize( sData );
 
-			LARGE_INTEGER lFileSize;
-			BOOL ret = GetFileSizeEx(hFile, &lFileSize);
-			CloseHandle(hFile);
+	std::string sIndex = indexPath( sArchivePath );
+	std::string sTemp = sIndex + '.' + std::to_string( getpid() );
+	int fd = ::open( sTemp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666 );
+	countSyscall( SYSCALL_OPEN );
 
-			if ( ret == FALSE ) {
-				std::cerr << "cannot retrieve file size: " << sLocalPath << std::endl;
-				closedir(dir);
-				return false;
-			}
+	if ( fd == -1 )
+		return;
 
-			entry.path = sLocalPath;
-			entry.size = lFileSize.QuadPart;
-			sHeader += "\"" + e + "\":{\"size\":" + std::to_string(entry.size) + ",\"offset\":\"" + std::to_string(szOffset) + "\"";
-			szOffset += entry.size;
+	bool ok = pwriteAll( fd, sData.data(), sData.size(), 0 );
 
-			if (attrHidden)
-				sHeader += ",\"hidden\":true";
+	::close( fd );
+	countSyscall( SYSCALL_OPEN );
 
-			sHeader += '}';
+	if ( !ok || ::rename( sTemp.c_str(), sIndex.c_str() ) != 0 )
+		::unlink( sTemp.c_str() );
+}
 #else
-			struct stat st;
-			if ( lstat( sLocalPath.c_str(), &st ) == -1) {
-				perror("stat()");
-				closedir(dir);
-				return false;
-			}
-
-			entry.path = sLocalPath;
-			sHeader += "\"" + e;
+std::string asarArchive::indexPath( const std::string &sArchivePath ) const {
+	return sArchivePath + ".idx";
+}
 
-			if (S_ISLNK(st.st_mode)) {
-				char buf[4096];
-				sHeader += "\":{\"link\":\"";
+bool asarArchive::loadIndex( const std::string &, entryTable & ) {
+	return false;
+}
 
-				if ( readlink( sLocalPath.c_str(), buf, sizeof(buf)-1) > 0 ) {
-					entry.link_target = buf;
-					sHeader += buf;
-				}
-				sHeader += "\"}";
-				entry.size = 0;
-				entry.type = 'L';
-			} else {
-				sHeader += "\":{\"size\":" + std::to_string(st.st_size) + ",\"offset\":\"" + std::to_string(szOffset);
-				if ( st.st_mode & S_IXUSR ) {
-					sHeader += "\",\"executable\":true}";
-					entry.type = 'X';
-				} else {
-					sHeader += "\"}";
-					entry.type = 'F';
-				}
-				szOffset += st.st_size;
-				entry.size = st.st_size;
-			}
+void asarArchive::saveIndex( const std::string &, const entryTable & ) {}
 #endif  // !_WIN32
-			vFileList.push_back(entry);
+
+bool asarArchive::open( const std::string &sArchivePath ) {
+	statsScope scope( m_stats );
+
+	close();
+
+	if ( !openArchive(sArchivePath) )
+		return false;
+
+	bool ok = true;
+
+	// no DOM needed, the table is all that is kept
+	if ( !m_bIndex || !loadIndex( sArchivePath, m_entries ) ) {
+		ok = streamHeader( m_entries, nullptr );
+
+		if ( ok ) {
+			traceScope trace( m_trace, "index" );
+			m_entries.buildIndex();
 		}
+		if ( ok && m_bIndex )
+			saveIndex( sArchivePath, m_entries );
+	}
 
-		sHeader.push_back(',');
+	if ( !ok ) {
+		close();
+		return false;
 	}
 
-	closedir(dir);
+	if ( m_bRecordAccess ) {
+		std::lock_guard<std::mutex> lock(m_accessMutex);
+		m_vAccessed.assign( m_entries.size(), false );
+		m_vAccessOrder.clear();
+	}
+
+	m_bOpen = true;
 
 	return true;
 }
 
-int asarArchive::getFiles( rapidjson::Value& object, std::vector<fileEntry_t> &vFileList, const std::string &sPath ) {
-	if ( !object.IsObject() ) // how ?
-		return -1;
+void asarArchive::close() {
+	closeArchive();
 
-	int n = 0;
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_bOpen = false;
+	m_entries.clear();
+	m_lruList.clear();
+	m_mapCache.clear();
+	m_cacheSize = 0;
+}
 
-	for ( auto itr = object.MemberBegin(); itr != object.MemberEnd(); ++itr, ++n ) {
-		rapidjson::Value& vMember = itr->value;
-		if ( !vMember.IsObject() ) continue;
+// index of an entry of the archive kept open by open(), entryTable::NONE if not found
+uint32_t asarArchive::findEntry( const std::string &sPath ) const {
+	return m_bOpen ? m_entries.find( sPath ) : entryTable::NONE;
+}
 
-		std::string sFilePath = sPath + itr->name.GetString();
+bool asarArchive::stat( const std::string &sPath, fileEntry_t &entry ) const {
+	uint32_t i = findEntry( sPath );
 
-		if ( vMember.HasMember("files") ) {
-			int ret = getFiles( vMember["files"], vFileList, sFilePath + '/' );
-
-			if ( ret == 0 ) {
-				// create empty directory entry
-				fileEntry_t file;
-				file.path = sFilePath;
-				file.size = 0;
-				file.offset = 0;
-				file.type = 'D';
-				vFileList.push_back( file );
-				continue;
-			} else if ( ret == -1 )
-				return -1;
-		} else {
-			fileEntry_t file;
+	if ( i == entryTable::NONE )
+		return false;
 
-			if ( vMember.HasMember("link") && vMember["link"].IsString() ) {
-				file.path = sFilePath;
-				file.size = 0;
-				file.offset = 0;
-				file.type = 'L';
-				file.link_target = vMember["link"].GetString();
-				vFileList.push_back( file );
-				continue;
-			} else if ( vMember.HasMember("directory") && vMember["directory"].IsString() ) {
-				file.path = sFilePath;
-				file.size = 0;
-				file.offset = 0;
-				file.type = 'D';
-				vFileList.push_back( file );
-				continue;
-			}
+	const entryTable::entry_t &e = m_entries[i];
+	entry.path = m_entries.path(i);
+	entry.size = ( e.type == 'D' ) ? 0 : e.size;
+	entry.offset = e.offset;
+	entry.type = e.type;
+	entry.link_target = m_entries.link(i);
+	return true;
+}
 
-			if ( !( vMember.HasMember("size") && vMember.HasMember("offset") &&
-					vMember["size"].IsInt() && vMember["offset"].IsString() ) )
-				continue;
+void asarArchive::setCacheSize( size_t limit, size_t maxFileSize ) {
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
+	m_cacheLimit = limit;
+	m_cacheMaxFile = maxFileSize;
 
-			file.path = sFilePath;
-			file.size = vMember["size"].GetUint();
-			file.offset = std::stoi( vMember["offset"].GetString() );
-			file.type = 'F';
+	while ( m_cacheSize > m_cacheLimit ) {
+		auto it = m_mapCache.find( m_lruList.back() );
+		m_cacheSize -= it->second.data->size();
+		m_mapCache.erase(it);
+		m_lruList.pop_back();
+	}
+}
 
-#ifndef _WIN32
-			if (vMember.HasMember("executable") && vMember["executable"].IsBool() &&
-				vMember["executable"].GetBool() == true)
-				file.type = 'X';
-#endif
+// Get the contents of a file small enough for the cache,
+// loading it on a miss. Returns NULL if it is not cacheable.
+std::shared_ptr<const std::string> asarArchive::getCached( size_t index ) {
+	const entryTable::entry_t &e = m_entries[index];
+
+	{
+		std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+		if ( e.size > m_cacheMaxFile || e.size > m_cacheLimit )
+			return NULL;
 
-			vFileList.push_back( file );
+		auto it = m_mapCache.find(index);
+		if ( it != m_mapCache.end() ) {
+			m_lruList.splice( m_lruList.begin(), m_lruList, it->second.itLru );
+			m_stats.cacheHits++;
+			return it->second.data;
 		}
 	}
 
-	return n;
-}
+	m_stats.cacheMisses++;
 
-bool asarArchive::unpackFiles( std::vector<fileEntry_t> &vFileList ) {
-	for ( auto &file : vFileList ) {
-		// like "mkdir -p"
-		for (auto &e : file.path) {
-			if ( IS_DIR_SEPARATOR(e) ) {
-				e = 0;
-				_mkdir(file.path.c_str());
-				e = '/';
-			}
-		}
+	// read without holding the lock
+	std::shared_ptr<std::string> data = std::make_shared<std::string>(e.size, '\0');
+	if ( e.size > 0 && !readAt( &(*data)[0], e.size, m_headerSize + e.offset ) )
+		return NULL;
 
-		if ( !unpackSingleFile(file, file.path) )
-			return false;
-	}
-	return true;
-}
+	std::lock_guard<std::mutex> lock(m_cacheMutex);
 
-bool asarArchive::unpackSingleFile( const fileEntry_t &file, const std::string &sOutPath ) {
-	if (file.type == 'L') {
-#ifdef _WIN32
-		// symbolic links (not .lnk files!) on Windows/NTFS are used differently
-		// from Unix, so instead we create a text file with the link target
-		std::ofstream ofsOutputFile( sOutPath.c_str(), std::ios::trunc );
+	// another thread may have loaded it in the meantime
+	auto it = m_mapCache.find(index);
+	if ( it != m_mapCache.end() )
+		return it->second.data;
 
-		if ( !ofsOutputFile ) {
-			std::cerr << "Error when writing to file " << sOutPath << std::endl;
-			return false;
-		}
-		ofsOutputFile << file.link_target;
-		ofsOutputFile.close();
-#else
-		if ( symlink( file.link_target.c_str(), sOutPath.c_str() ) != 0 ) {
-			perror("symlink()");
-			return false;
-		}
-#endif
-		return true;
-	} else if (file.type == 'D') {
-		return (_mkdir(sOutPath.c_str()) == 0);
+	while ( m_cacheSize + e.size > m_cacheLimit && !m_lruList.empty() ) {
+		auto itOld = m_mapCache.find( m_lruList.back() );
+		m_cacheSize -= itOld->second.data->size();
+		m_mapCache.erase(itOld);
+		m_lruList.pop_back();
 	}
 
-	std::ofstream ofsOutputFile( sOutPath.c_str(), std::ios::trunc | std::ios::binary );
+	m_lruList.push_front(index);
+	cacheEntry_t &c = m_mapCache[index];
+	c.itLru = m_lruList.begin();
+	c.data = data;
+	m_cacheSize += e.size;
 
-	if ( !ofsOutputFile ) {
-		std::cerr << "Error when writing to file " << sOutPath << std::endl;
-		return false;
-	}
+	return data;
+}
 
-	if (file.size > 0) {
-		char fileBuf[BUFF_SIZE];
-		size_t uSize = file.size;
-		m_ifsInputFile.seekg(m_headerSize + file.offset);
+// Read up to size bytes starting at offset of a file.
+// Returns the number of bytes read, -1 on error.
+int64_t asarArchive::read( const std::string &sPath, size_t offset, size_t size, char *buf ) {
+	statsScope scope( m_stats );
+	uint32_t i = findEntry( sPath );
 
-		while (uSize > BUFF_SIZE) {
-			m_ifsInputFile.read(fileBuf, BUFF_SIZE);
-			ofsOutputFile.write(fileBuf, BUFF_SIZE);
-			uSize -= BUFF_SIZE;
-		}
+	if ( i == entryTable::NONE || (m_entries[i].type != 'F' && m_entries[i].type != 'X') )
+		return -1;
 
-		if (uSize > 0) {
-			m_ifsInputFile.read(fileBuf, uSize);
-			ofsOutputFile.write(fileBuf, uSize);
-		}
-	}
+	if ( m_bRecordAccess )
+		noteAccess( i );
 
-	ofsOutputFile.close();
+	const entryTable::entry_t *e = &m_entries[i];
 
-#ifndef _WIN32
-	if (file.type == 'X')
-		chmod(sOutPath.c_str(), 0775);
-#endif
+	if ( offset >= e->size )
+		return 0;
 
-	return true;
-}
+	size = std::min<uint64_t>( size, e->size - offset );
 
-// Unpack archive to a specific location
-bool asarArchive::unpack( const std::string &sArchivePath, std::string sOutPath, std::string sExtractFile ) {
-	m_ifsInputFile.open( sArchivePath, std::ios::binary );
-	if ( !m_ifsInputFile ) {
-		std::cerr << "cannot open file: " << sArchivePath << std::endl;
-		return false;
-	}
+	std::shared_ptr<const std::string> data = getCached( i );
 
-	// first 16 bytes consist of 4 numbers stored as uint32_t little endian:
-	// uHdr1 = 4
-	// uHdr2 = <JSON header size> + 8
-	// uHdr3 = <JSON header size> + 4
-	// uSize = <JSON header size>
-	char sizeBuf[16];
+	if ( data ) {
+		memcpy( buf, data->data() + offset, size );
+		return size;
+	}
 
-	if ( !m_ifsInputFile.read( sizeBuf, 16 ) ) {
-		std::cerr << "unexpected file header size" << std::endl;
-		m_ifsInputFile.close();
-		return false;
+	if ( m_pMap ) {
+		const char *p;
+		std::vector<char> vUnused;
+		if ( !getView( m_headerSize + e->offset + offset, size, p, vUnused ) )
+			return -1;
+		memcpy( buf, p, size );
+		return size;
 	}
 
-	const uint32_t uHdr1 = le32toh( *(reinterpret_cast<uint32_t*>(sizeBuf)) );
-	const uint32_t uHdr2 = le32toh( *(reinterpret_cast<uint32_t*>(sizeBuf + 4)) );
-	const uint32_t uHdr3 = le32toh( *(reinterpret_cast<uint32_t*>(sizeBuf + 8)) );
-	const uint32_t uSize = le32toh( *(reinterpret_cast<uint32_t*>(sizeBuf + 12)) );
+	return readAt( buf, size, m_headerSize + e->offset + offset ) ? static_cast<int64_t>(size) : -1;
+}
 
-    // The JSON header is written in 4 byte blocks so it can contain spaces at the end
-    const unsigned short int uHdrX = uSize % 4 > 0 ? 4 - uSize % 4 : 0;
-        
-	if ( uHdr1 != 4 ||
-		( uHdr2 != (uSize + uHdrX + 8) && uHdr2 != (uSize + 8) ) ||
-		( uHdr3 != (uSize + uHdrX + 4) && uHdr3 != (uSize + 4) ) ) {
-		std::cerr << "unexpected file header data" << std::endl;
-		m_ifsInputFile.close();
+// Read a whole file
+bool asarArchive::readAll( const std::string &sPath, std::string &sData ) {
+	statsScope scope( m_stats );
+	uint32_t i = findEntry( sPath );
+
+	if ( i == entryTable::NONE || (m_entries[i].type != 'F' && m_entries[i].type != 'X') )
 		return false;
-	}
 
-	char *headerBuf = new char[uSize + 1](); // initialize with zeros
-	m_headerSize = uSize + 16;
+	if ( m_bRecordAccess )
+		noteAccess( i );
 
-	if (!m_ifsInputFile.read(headerBuf, uSize)) {
-		std::cerr << "JSON header data too short" << std::endl;
-		m_ifsInputFile.close();
-		delete headerBuf;
-		return false;
+	const entryTable::entry_t *e = &m_entries[i];
+	std::shared_ptr<const std::string> data = getCached( i );
+
+	if ( data ) {
+		sData = *data;
+		return true;
 	}
 
-	rapidjson::Document json;
-	rapidjson::ParseResult res = json.Parse(headerBuf);
-	delete headerBuf;
+	sData.resize( e->size );
+	return read( sPath, 0, e->size, &sData[0] ) == static_cast<int64_t>(e->size);
+}
+
+void asarArchive::noteAccess( uint32_t index ) {
+	std::lock_guard<std::mutex> lock(m_accessMutex);
 
-	if ( !res ) {
-		std::cout << rapidjson::GetParseError_En(res.Code()) << std::endl;
-		m_ifsInputFile.close();
-		return false;
+	if ( index < m_vAccessed.size() && !m_vAccessed[index] ) {
+		m_vAccessed[index] = true;
+		m_vAccessOrder.push_back( m_entries.path(index) );
 	}
+}
 
-	if ( !sOutPath.empty() ) {
-		if ( !IS_DIR_SEPARATOR( sOutPath.back() ) )
-			sOutPath.push_back( '/' );
+bool asarArchive::writeAccessOrder( const std::string &sOrderingPath ) const {
+	std::lock_guard<std::mutex> lock(m_accessMutex);
+	std::ofstream ofs;
 
-		if ( !sExtractFile.empty() )
-			sExtractFile.insert(0, sOutPath);
+	if ( sOrderingPath != "-" ) {
+		ofs.open( sOrderingPath, std::ios::trunc );
+		if ( !ofs.is_open() ) {
+			std::cerr << "cannot open file for writing: " << sOrderingPath << std::endl;
+			return false;
+		}
 	}
 
-	std::vector<fileEntry_t> vFileList;
-	bool ret = getFiles( json["files"], vFileList, sOutPath );
+	std::ostream &os = ( sOrderingPath == "-" ) ? std::cout : ofs;
 
-	if ( !ret ) {
-		m_ifsInputFile.close();
-		return false;
-	}
+	for ( const auto &s : m_vAccessOrder )
+		os << s << '\n';
+	os.flush();
 
-	if ( !sExtractFile.empty() ) {
-		// extract single file
-		for ( const auto &e : vFileList ) {
-			if ( e.path == sExtractFile ) {
-				// basename
-				size_t pos = sExtractFile.find_last_of(DIR_SEPARATORS);
-				if ( pos != std::string::npos )
-					sExtractFile.erase(0, pos+1);
+	return os.good();
+}
 
-				ret = unpackSingleFile( e, sExtractFile );
-				break;
-			}
+// One line of an strace log: the name of the system call, its arguments
+// as written (quoted strings still quoted) and the result. Lines may start
+// with a pid ("1234 " or "[pid 1234] ") and a timestamp. False for other
+// lines and for calls split by -f ("<unfinished ...>"), which are left out.
+static bool parseSyscall( const std::string &sLine, std::string &sName, std::vector<std::string> &vArgs, int64_t &result ) {
+	size_t pos = 0;
+
+	for (;;) {
+		while ( pos < sLine.size() && sLine[pos] == ' ' )
+			pos++;
+		if ( sLine.compare( pos, 4, "[pid" ) == 0 ) {
+			pos = sLine.find( ']', pos );
+			if ( pos == std::string::npos )
+				return false;
+			pos++;
+		} else if ( pos < sLine.size() && isdigit(static_cast<unsigned char>(sLine[pos])) ) {
+			pos = sLine.find( ' ', pos );
+			if ( pos == std::string::npos )
+				return false;
+		} else {
+			break;
 		}
-	} else if ( sOutPath.empty() ) {
-		// print file list
+	}
 
-		//auto lambda = [](const fileEntry_t &a, const fileEntry_t &b) {
-		//	return strcmp(a.path.c_str(), b.path.c_str()) < 0;
-		//};
-		//std::sort( vFileList.begin(), vFileList.end(), lambda );
-		for ( const auto &e : vFileList )
-			std::cout << e.path << std::endl;
-	} else {
-		// extract all files
-		DIR *dir = opendir( sOutPath.c_str() );
+	size_t start = pos;
+	while ( pos < sLine.size() && (isalnum(static_cast<unsigned char>(sLine[pos])) || sLine[pos] == '_') )
+		pos++;
+	if ( pos == start || pos >= sLine.size() || sLine[pos] != '(' )
+		return false;
+	sName = sLine.substr( start, pos - start );
 
-		// check if directory is empty
-		if ( dir ) {
-			int i = 0;
-			while ( readdir(dir) ) i++;
-			closedir(dir);
-			if (i > 2) {
-				std::cerr << "directory is not empty: " << sOutPath << std::endl;
-				m_ifsInputFile.close();
-				return false;
+	// split at the commas outside of strings and brackets
+	int depth = 0;
+	vArgs.clear();
+	start = ++pos;
+
+	for ( ; pos < sLine.size(); pos++ ) {
+		char c = sLine[pos];
+
+		if ( c == '"' ) {
+			for ( pos++; pos < sLine.size() && sLine[pos] != '"'; pos++ ) {
+				if ( sLine[pos] == '\\' )
+					pos++;
 			}
-		} else if (errno != ENOENT ) {
-			// "Directory does not exist" is the only error we accept
-			int errsv = errno;
-			std::cerr << "error trying to open directory:" << std::endl;
-			errno = errsv;
-			perror( sOutPath.c_str() );
-			m_ifsInputFile.close();
-			return false;
+		} else if ( c == '(' || c == '[' || c == '{' ) {
+			depth++;
+		} else if ( (c == ')' || c == ']' || c == '}') && depth > 0 ) {
+			depth--;
+		} else if ( (c == ',' || c == ')') && depth == 0 ) {
+			size_t first = sLine.find_first_not_of( ' ', start );
+			vArgs.push_back( sLine.substr( first, pos - first ) );
+			start = pos + 1;
+			if ( c == ')' )
+				break;
 		}
-
-		ret = unpackFiles( vFileList );
 	}
 
-	m_ifsInputFile.close();
+	if ( pos >= sLine.size() )
+		return false;
 
-	return ret;
+	// ") = 4096", maybe followed by an error or the time spent
+	pos = sLine.find_first_not_of( ' ', pos + 1 );
+	if ( pos == std::string::npos || sLine[pos] != '=' )
+		return false;
+
+	char *end;
+	const char *p = sLine.c_str() + pos + 1;
+	result = strtoll( p, &end, 0 );
+
+	return end != p;
 }
 
-// Pack archive
-bool asarArchive::pack(
-	const std::string &sPath,
-	const std::string &sArchivePath,
-	const char *unpack,
-	const char *unpackDir,
-	bool excludeHidden
-) {
-	std::vector<fileEntry_t> vFileList;
-	std::string sHeader = "{\"files\":{";
-	size_t szOffset = 0;
+// the path of a quoted strace string, or after the descriptor with -y: 23</a/b>
+static std::string stracePath( const std::string &sArg ) {
+	size_t first = sArg.find_first_of( "\"<" );
+	size_t last = sArg.find_last_of( "\">" );
 
-	if ( !createJsonHeader( sPath, sHeader, szOffset, vFileList, unpack, unpackDir, excludeHidden ) )
-		return false;
+	if ( first == std::string::npos || last <= first )
+		return "";
+	return sArg.substr( first + 1, last - first - 1 );
+}
 
-	sHeader.pop_back();  // remove trailing comma
-	sHeader += "}}";
+bool asarArchive::profile( const std::string &sArchivePath, const std::string &sLogPath, const std::string &sOrderingPath ) {
+	std::ifstream ifs;
 
-	std::ofstream ofsOutputFile( sArchivePath, std::ios::binary | std::ios::trunc );
-	if ( !ofsOutputFile.is_open() ) {
-		std::cerr << "cannot open file for writing: " << sArchivePath << std::endl;
-		return false;
+	if ( sLogPath != "-" ) {
+		ifs.open( sLogPath );
+		if ( !ifs.is_open() ) {
+			std::cerr << "cannot open file for reading: " << sLogPath << std::endl;
+			return false;
+		}
 	}
 
-	char cHeader[16];
-	char *p = cHeader;
+	bool bRecord = m_bRecordAccess;
+	m_bRecordAccess = true;
+	bool ok = open( sArchivePath );
+	m_bRecordAccess = bRecord;
 
-	// offset 0x00
-	uint32_t uSize = htole32(4);
-	memcpy( p, &uSize, 4 );
-	p = cHeader + 4;
+	if ( !ok )
+		return false;
 
-	// offset 0x04
-	uSize = htole32( sHeader.size() + 8 );
-	memcpy( p, &uSize, 4 );
-	p += 4;
+	// the files with data by their position in the archive, the first
+	// one of files that share their data
+	std::vector<std::pair<uint64_t, uint32_t>> vData;
 
-	// offset 0x08
-	uSize = htole32( sHeader.size() + 4 );
-	memcpy( p, &uSize, 4 );
-	p += 4;
+	for ( size_t i = 0; i < m_entries.size(); i++ ) {
+		const entryTable::entry_t &e = m_entries[i];
+		if ( (e.type == 'F' || e.type == 'X') && e.size > 0 )
+			vData.emplace_back( m_headerSize + e.offset, i );
+	}
+	std::sort( vData.begin(), vData.end() );
 
-	// offset 0x0C
-	uSize = htole32( sHeader.size() );
-	memcpy( p, &uSize, 4 );
+	// every file that overlaps [from, to)
+	auto access = [&] ( uint64_t from, uint64_t to ) {
+		auto it = std::upper_bound( vData.begin(), vData.end(), std::make_pair(from, entryTable::NONE) );
+		if ( it != vData.begin() )
+			--it;
 
-	ofsOutputFile.write( cHeader, 16 );
-	ofsOutputFile << sHeader;
+		for ( ; it != vData.end() && it->first < to; ++it ) {
+			if ( it->first + m_entries[it->second].size > from &&
+					(it == vData.begin() || (it - 1)->first != it->first) )
+				noteAccess( it->second );
+		}
+	};
 
-	char fileBuf[BUFF_SIZE];
+	// descriptors of the archive and their file position
+	std::string sBase = sArchivePath.substr( sArchivePath.find_last_of( DIR_SEPARATORS ) + 1 );
+	std::map<long, uint64_t> mapFd;
+	std::istream &is = ( sLogPath == "-" ) ? std::cin : ifs;
+	std::string sLine, sName;
+	std::vector<std::string> vArgs;
+	int64_t result;
+	size_t lines = 0;
 
-	for (const auto &e : vFileList) {
-#ifndef _WIN32
-		// skip symbolic link
-		if (e.type == 'L') continue;
-#endif
-		std::ifstream ifsFile( e.path, std::ios::binary );
+	auto isArchive = [&sBase] ( const std::string &sPath ) {
+		return sPath.size() >= sBase.size() && sPath.compare( sPath.size() - sBase.size(), sBase.size(), sBase ) == 0 &&
+			(sPath.size() == sBase.size() || sPath[sPath.size() - sBase.size() - 1] == '/');
+	};
 
-		if ( !ifsFile.is_open() ) {
-			std::cerr << "cannot open file for reading: " << e.path << std::endl;
-			ofsOutputFile.close();
-			return false;
-		}
+	while ( std::getline(is, sLine) ) {
+		if ( !parseSyscall( sLine, sName, vArgs, result ) || vArgs.empty() || result < 0 )
+			continue;
+		lines++;
 
-		size_t szFile = e.size;
+		long fd = strtol( vArgs[0].c_str(), NULL, 10 );
+		auto it = mapFd.find( fd );
 
-		if (szFile > 0) {
-			while (szFile > BUFF_SIZE) {
-				ifsFile.read(fileBuf, BUFF_SIZE);
-				ofsOutputFile.write(fileBuf, BUFF_SIZE);
-				szFile -= BUFF_SIZE;
-			}
+		// with -y the path follows every descriptor
+		if ( it == mapFd.end() && vArgs[0].find('<') != std::string::npos && isArchive( stracePath(vArgs[0]) ) &&
+				sName != "close" )
+			it = mapFd.emplace( fd, 0 ).first;
 
-			if (szFile > 0) {
-				ifsFile.read(fileBuf, szFile);
-				ofsOutputFile.write(fileBuf, szFile);
-			}
+		if ( sName == "open" || sName == "openat" || sName == "creat" ) {
+			size_t arg = ( sName == "openat" ) ? 1 : 0;
+			if ( vArgs.size() > arg && isArchive( stracePath(vArgs[arg]) ) )
+				mapFd[result] = 0;
+			else
+				mapFd.erase( result );
+		} else if ( it == mapFd.end() ) {
+			continue;
+		} else if ( sName == "close" ) {
+			mapFd.erase( it );
+		} else if ( sName == "dup" || sName == "dup2" || sName == "dup3" || sName == "fcntl" || sName == "fcntl64" ) {
+			if ( sName.compare(0, 5, "fcntl") != 0 || (vArgs.size() > 1 && vArgs[1].compare(0, 7, "F_DUPFD") == 0) )
+				mapFd[result] = it->second;
+		} else if ( sName == "pread64" || sName == "pread" || sName == "preadv" || sName == "preadv2" ) {
+			if ( vArgs.size() >= 4 )
+				access( strtoull( vArgs[3].c_str(), NULL, 10 ), strtoull( vArgs[3].c_str(), NULL, 10 ) + result );
+		} else if ( sName == "read" || sName == "readv" ) {
+			access( it->second, it->second + result );
+			it->second += result;
+		} else if ( sName == "lseek" ) {
+			it->second = result;
 		}
-
-		ifsFile.close();
 	}
 
-	ofsOutputFile.close();
+	close();
 
-	return true;
-}
+	if ( lines == 0 )
+		std::cerr << "no system calls found in " << sLogPath << std::endl;
+	std::cerr << m_vAccessOrder.size() << " files read" << std::endl;
 
-// List archive content
-bool asarArchive::list( const std::string &sArchivePath ) {
-	return unpack( sArchivePath, "", "" );
+	return writeAccessOrder( sOrderingPath );
 }
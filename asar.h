@@ -29,43 +29,384 @@
 #include <rapidjson/document.h>
 #include <string>
 #include <fstream>
+#include <functional>
+#include <ostream>
 #include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+#include "entrytable.h"
+#include "pathmatcher.h"
+#include "trace.h"
 
 
 class asarArchive {
 
-private:
+public:
+	// how payload data was moved between files
+	enum copyMethod_t {
+		COPY_FILE_RANGE = 0,  // copy_file_range(), possibly a reflink
+		COPY_SENDFILE,        // sendfile()
+		COPY_MMAP,            // write() from the archive mapping
+		COPY_BUFFERED,        // read() and write() through a buffer
+		COPY_URING,           // write() from the archive mapping through io_uring
+		COPY_METHODS
+	};
+
+	// system calls counted by stats_t
+	enum syscall_t {
+		SYSCALL_OPEN = 0,  // open(), openat(), close()
+		SYSCALL_STAT,      // stat(), fstat(), fstatat()
+		SYSCALL_READ,      // pread(), readlink()
+		SYSCALL_WRITE,     // pwrite(), ftruncate(), fallocate()
+		SYSCALL_COPY,      // copy_file_range(), sendfile()
+		SYSCALL_MKDIR,     // mkdir(), symlink(), chmod()
+		SYSCALL_DIR,       // opendir(), readdir()
+		SYSCALL_CACHE,     // posix_fadvise(), sync_file_range(), fdatasync()
+		SYSCALL_URING,     // io_uring_enter()
+		SYSCALL_KINDS
+	};
+
+	struct stats_t {
+		// files and bytes per copy method
+		std::atomic<uint64_t> copyFiles[COPY_METHODS];
+		std::atomic<uint64_t> copyBytes[COPY_METHODS];
+
+		// entries packed or extracted
+		std::atomic<uint64_t> files;
+		std::atomic<uint64_t> links;
+		std::atomic<uint64_t> dirs;
+
+		// file I/O of the operation, bytes moved by the kernel count as read and written
+		std::atomic<uint64_t> syscalls[SYSCALL_KINDS];
+		std::atomic<uint64_t> bytesRead;
+		std::atomic<uint64_t> bytesWritten;
+
+		// read() / readAll() file cache
+		std::atomic<uint64_t> cacheHits;
+		std::atomic<uint64_t> cacheMisses;
+
+		// JSON header generation in pack()
+		std::atomic<uint64_t> headerBytes;
+		std::atomic<uint64_t> headerNanos;
+
+		// pack() with a base archive: payloads taken from it and read from disk
+		std::atomic<uint64_t> reuseFiles;
+		std::atomic<uint64_t> reuseBytes;
+		std::atomic<uint64_t> freshFiles;
+		std::atomic<uint64_t> freshBytes;
+
+		// pack() with deduplication: files stored at the offset of an identical one
+		std::atomic<uint64_t> dedupFiles;
+		std::atomic<uint64_t> dedupBytes;
+
+		// integrity hashes: SHA-256 input bytes and wall time
+		std::atomic<uint64_t> hashBytes;
+		std::atomic<uint64_t> hashNanos;
+
+		stats_t() { reset(); }
+
+		void reset() {
+			for ( int i = 0; i < COPY_METHODS; i++ ) {
+				copyFiles[i] = 0;
+				copyBytes[i] = 0;
+			}
+			files = 0;
+			links = 0;
+			dirs = 0;
+			for ( int i = 0; i < SYSCALL_KINDS; i++ )
+				syscalls[i] = 0;
+			bytesRead = 0;
+			bytesWritten = 0;
+			cacheHits = 0;
+			cacheMisses = 0;
+			headerBytes = 0;
+			headerNanos = 0;
+			reuseFiles = 0;
+			reuseBytes = 0;
+			freshFiles = 0;
+			freshBytes = 0;
+			dedupFiles = 0;
+			dedupBytes = 0;
+			hashBytes = 0;
+			hashNanos = 0;
+		}
+	};
+
+	// an entry as returned by stat(), internally entries are kept in an entryTable
 	typedef struct {
 		std::string path;
-		size_t size;
-		size_t offset;
+		uint64_t size;
+		uint64_t offset;
 		char type;  // 'F' regular file
 					// 'L' symbolic link
 					// 'X' executable file
-					// 'D' directory (empty)
+					// 'D' directory
 		std::string link_target;
 	} fileEntry_t;
 
+private:
+	typedef std::list<size_t> lruList_t;
+
+	typedef struct {
+		lruList_t::iterator itLru;
+		std::shared_ptr<const std::string> data;
+	} cacheEntry_t;
+
+	// one SHA-256 over a range of a file, see hashFiles()
+	typedef struct {
+		size_t file;      // index into the entry table
+		uint64_t offset;  // range within the file
+		uint64_t size;
+		long block;       // index of the integrity block, -1 for the whole file
+		size_t pos;       // pack: position of the hex digest in the JSON header
+		const char *expected;  // verify: hex digest from the JSON header
+		uint8_t digest[32];
+	} hashJob_t;
+
 	std::ifstream m_ifsInputFile;
+#ifndef _WIN32
+	int m_fd = -1;  // used for positional reads, so workers don't share a seek position
+#endif
+	const char *m_pMap = NULL;  // read-only mapping of the whole archive, if available
+	size_t m_mapSize = 0;
 	size_t m_headerSize = 0;
+	unsigned m_jobs = 0;
+	bool m_bIntegrity = false;
+	bool m_bDedup = false;
+	bool m_bUring = false;
+	bool m_bNoCache = false;
+	std::string m_sBaseArchive;
+	bool m_bBaseTrustMtime = false;  // see setBaseArchive()
+	std::string m_sOrdering;  // see setOrdering()
+	const pathMatcher *m_pInclude = NULL;  // see setSelection()
+	const pathMatcher *m_pExclude = NULL;
+	std::vector<std::string> m_vSubtrees;
+	bool m_bIndex = false;  // see setIndex()
+	std::string m_sIndexDir;
+	stats_t m_stats;
+	traceLog m_trace;
+#ifdef _WIN32
+	std::mutex m_readMutex;  // readAt() seeks the shared ifstream
+#endif
+
+	// state of an archive kept open by open()
+	bool m_bOpen = false;
+	entryTable m_entries;  // with a path index
+
+	// LRU cache of small files for read() / readAll()
+	std::mutex m_cacheMutex;
+	lruList_t m_lruList;  // m_entries indices, most recently used first
+	std::unordered_map<size_t, cacheEntry_t> m_mapCache;
+	size_t m_cacheSize = 0;
+	size_t m_cacheLimit = 0;
+	size_t m_cacheMaxFile = 0;
+
+	// first reads of files through read() / readAll(), see setRecordAccess()
+	mutable std::mutex m_accessMutex;
+	bool m_bRecordAccess = false;
+	std::vector<bool> m_vAccessed;  // by m_entries index
+	std::vector<std::string> m_vAccessOrder;
+
+	struct headerDom_t;  // see asar.cpp
+
+	int getFiles( rapidjson::Value& object, entryTable &files, uint32_t parent,
+		std::vector<const rapidjson::Value *> *pvIntegrity = NULL );
+	bool unpackFiles( const std::string &sOutPath );
+	bool unpackSingleFile( const entryTable &files, size_t index, const std::string &sOutPath, char *fileBuf,
+		const char *pData = NULL, int dirFd = -1 );
+	bool readAt( char *buf, size_t size, uint64_t offset );
+	bool getView( uint64_t offset, size_t size, const char *&pData, std::vector<char> &vBuf );
+	bool openArchive( const std::string &sArchivePath );
+	void closeArchive();
+	bool findHeader( const char *&pHeader, uint32_t &uSize, std::vector<char> &vBuf );
+	bool loadHeader( headerDom_t &dom );
+	bool streamHeader( entryTable &files, const std::function<bool(size_t)> &emit, bool bSelect = false );
+	uint32_t findEntry( const std::string &sPath ) const;
+	std::string indexPath( const std::string &sArchivePath ) const;
+	bool loadIndex( const std::string &sArchivePath, entryTable &files );
+	void saveIndex( const std::string &sArchivePath, const entryTable &files );
+	std::shared_ptr<const std::string> getCached( size_t index );
+	bool hashFiles( const entryTable &files, const std::string &sRoot, std::vector<hashJob_t> &vJobs, bool bFromArchive );
+	void printHashStats( std::ostream &os ) const;
 
-	int getFiles( rapidjson::Value& object, std::vector<fileEntry_t> &vFileList, const std::string &sPath );
-	bool unpackFiles( std::vector<fileEntry_t> &vFileList );
-	bool unpackSingleFile( const fileEntry_t &file, const std::string &sOutPath );
+	// directory tree read by scanTree(), children are sorted by name
+	typedef struct scanNode_s {
+		std::string name;
+		std::string path;  // path on disk
+		uint64_t size;
+		char type;  // like entryTable::entry_t
+		bool hidden;  // Windows hidden attribute
+		int64_t mtime;  // like entryTable::entry_t
+		int64_t staged = -1;  // pack from tar: position of the data in the staging area
+		std::string link_target;
+		std::vector<struct scanNode_s> children;
+
+		// deduplication: SHA-256 of the content and the inode of hard linked files
+		bool hashed = false;
+		uint8_t digest[32];
+		uint64_t dev = 0;
+		uint64_t ino = 0;  // 0 if the file has a single link
+	} scanNode_t;
+
+	struct scanContext_t;  // see asar.cpp
+	struct scanDir_t;
+	struct headerHandler_t;
+	struct uringBatch_t;
+	struct dirCache_t;
+
+	// files extracted together, see planRuns()
+	typedef struct {
+		size_t first, last;  // [first, last) of the sorted list of files
+		uint64_t start, end; // their data, relative to the header
+		bool small;          // only files of up to COALESCE_MAX_FILE bytes
+	} extractRun_t;
+
+	static void planRuns( const entryTable &files, std::vector<uint32_t> &vFiles, std::vector<extractRun_t> &vRuns );
+	bool extractRun( const entryTable &files, const std::vector<uint32_t> &vFiles, const extractRun_t &run,
+		const std::string &sOutPath, dirCache_t &dirs, char *fileBuf );
+
+	static void scanDirectory( scanContext_t &ctx, unsigned worker, scanNode_t *node, std::shared_ptr<scanDir_t> parent );
+	bool scanTree( scanNode_t &root, const pathMatcher *unpack, const pathMatcher *unpackDir, bool excludeHidden );
 
-	bool createJsonHeader(
-		const std::string &sPath,
+	struct headerWriter_t;  // see asar.cpp
+	struct baseArchive_t;
+	struct tarStaging_t;
+
+	void createJsonHeader(
+		const scanNode_t &root,
+		std::string &sHeader,
+		entryTable &files,
+		std::vector<hashJob_t> *pvHashJobs,
+		std::vector<std::pair<size_t, size_t>> &vDigestCopies,
+		std::vector<std::pair<size_t, uint32_t>> *pvOffsetPos = NULL );
+	bool applyOrdering(
+		entryTable &files,
+		std::string &sHeader,
+		const std::vector<std::pair<size_t, uint32_t>> &vOffsetPos,
+		std::vector<hashJob_t> &vHashJobs,
+		std::vector<std::pair<size_t, size_t>> &vDigestCopies );
+	void noteAccess( uint32_t index );
+	void writeJsonDir( headerWriter_t &w, const scanNode_t &dir, uint32_t parent );
+	bool planReuse(
+		baseArchive_t &base,
+		const scanNode_t &root,
+		const entryTable &files,
+		std::vector<hashJob_t> &vHashJobs,
 		std::string &sHeader,
-		size_t &szOffset,
-		std::vector<fileEntry_t> &vFileList,
-		const char *unpack,
-		const char *unpackDir,
-		bool excludeHidden);
+		std::vector<int64_t> &vBaseOffset );
+#ifndef _WIN32
+	bool uringAdd( uringBatch_t &b, size_t index, std::string &sPath );
+	bool uringReap( uringBatch_t &b, unsigned wait );
+	bool copyPayloads(
+		const std::string &sArchivePath,
+		int fdOut,
+		off_t dataPos,
+		const std::string &sRoot,
+		const entryTable &files,
+		const std::vector<int64_t> &vBaseOffset,
+		baseArchive_t *base );
+#endif
 
 public:
+	// number of worker threads used for packing and extraction, 0 = hardware threads
+	void setJobs( unsigned jobs ) { m_jobs = jobs; }
+
+	// extract small files and symbolic links through io_uring if the
+	// kernel supports it, the blocking system calls are used otherwise
+	void setUring( bool bUring ) { m_bUring = bUring; }
+
+	// drop the archive and the extracted files from the page cache as
+	// extraction goes, so it doesn't evict everything else; this writes
+	// the files back right away and turns off setUring()
+	void setNoCachePollution( bool bNoCache ) { m_bNoCache = bNoCache; }
+
+	// write SHA-256 integrity hashes like upstream asar with pack()
+	void setIntegrity( bool bIntegrity ) { m_bIntegrity = bIntegrity; }
+
+	// store identical files only once with pack()
+	void setDedup( bool bDedup ) { m_bDedup = bDedup; }
+
+	// Take unchanged files from this archive with pack(), "" to disable.
+	// Files are compared by the SHA-256 in the base archive's integrity
+	// data. If it has none, bTrustMtime takes files that are older than
+	// the base archive file as unchanged; that is wrong if the archive was
+	// copied, downloaded or restored after the files were edited.
+	void setBaseArchive( const std::string &sPath, bool bTrustMtime = false ) {
+		m_sBaseArchive = sPath;
+		m_bBaseTrustMtime = bTrustMtime;
+	}
+
+	// With pack(), put the data of the files listed in this file first, in
+	// the listed order, so reading them at startup is one sequential read;
+	// the header stays sorted. The format is that of upstream asar's
+	// --ordering. "" to disable.
+	void setOrdering( const std::string &sPath ) { m_sOrdering = sPath; }
+
+	// Keep a binary index of the header in "<archive>.idx", or in sCacheDir
+	// if it isn't empty. open() and list() load it instead of parsing the
+	// JSON header while the archive is unchanged, and write it if it is
+	// missing or out of date. Not available on Windows.
+	void setIndex( bool bIndex, const std::string &sCacheDir = "" ) { m_bIndex = bIndex; m_sIndexDir = sCacheDir; }
+
+	// Extract only a part of the archive with unpack(): the entries below
+	// one of vSubtrees (all if it is empty) that match include and don't
+	// match exclude (either may be NULL). A directory that matches include
+	// is extracted with everything in it, one that matches exclude is
+	// skipped as a whole. The matchers are used until the next call.
+	void setSelection( const pathMatcher *include, const pathMatcher *exclude, const std::vector<std::string> &vSubtrees );
+
 	bool unpack( const std::string &sArchivePath, std::string sOutPath, std::string sExtractFile = "" );
-	bool pack( const std::string &sPath, const std::string &sArchivePath, const char *unpack, const char *unpackDir, bool excludeHidden);
+	bool pack( const std::string &sPath, const std::string &sArchivePath, const pathMatcher *unpack, const pathMatcher *unpackDir, bool excludeHidden);
 	bool list( const std::string &sArchivePath );
+	bool extractFiles( const std::string &sArchivePath, const std::vector<std::string> &vFiles );
+	bool verify( const std::string &sArchivePath );
+
+	// Write the files of an archive in the order a program first read them
+	// to sOrderingPath ("-" for stdout), for setOrdering(). sLogPath is an
+	// strace log ("-" for stdin) of the program, e.g. from
+	// strace -f -e trace=open,openat,read,pread64,lseek,close,dup -o log
+	bool profile( const std::string &sArchivePath, const std::string &sLogPath, const std::string &sOrderingPath );
+
+	// Extract as a tar stream into sTarPath, "-" for stdout, limited by
+	// setSelection(). Pack the entries of a tar stream, "-" reads stdin;
+	// the data is held in memory or, if it is large, in a temporary file
+	// next to sArchivePath until the header is written. Not on Windows.
+	bool unpackToTar( const std::string &sArchivePath, const std::string &sTarPath );
+	bool packFromTar( const std::string &sTarPath, const std::string &sArchivePath, const pathMatcher *unpack,
+		const pathMatcher *unpackDir, bool excludeHidden );
+
+	const stats_t &stats() const { return m_stats; }
+	void printStats( std::ostream &os ) const;
+
+	// record the phases and the slowest files of the following operations,
+	// with bEvents also every event for writeTrace()
+	void setTrace( bool bEvents, size_t slowest = 10 ) { m_trace.enable( bEvents, slowest ); }
+	const traceLog &trace() const { return m_trace; }
+	bool writeTrace( const std::string &sPath ) const;
+
+	// Random access to a single archive: open() parses the header once,
+	// stat(), read() and readAll() may then be called from any thread
+	// until close(). Paths are relative to the archive root.
+	bool open( const std::string &sArchivePath );
+	void close();
+	bool stat( const std::string &sPath, fileEntry_t &entry ) const;
+	int64_t read( const std::string &sPath, size_t offset, size_t size, char *buf );
+	bool readAll( const std::string &sPath, std::string &sData );
+
+	// keep files of up to maxFileSize bytes in a cache of up to
+	// limit bytes, 0 disables the cache (the default)
+	void setCacheSize( size_t limit, size_t maxFileSize = 64*1024 );
+
+	// Record the order in which read() and readAll() first touch the
+	// files, starting with the next open(). writeAccessOrder() saves it
+	// like profile() does, also after close().
+	void setRecordAccess( bool bRecord ) { m_bRecordAccess = bRecord; }
+	bool writeAccessOrder( const std::string &sOrderingPath ) const;
 
 };
 
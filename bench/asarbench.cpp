@@ -0,0 +1,444 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Runs pack, list, extract and extract-file of an asar binary on a corpus
+// (see corpus.cpp) and prints the results as JSON on stdout, progress goes
+// to stderr. Every operation is run once untimed and then --runs times with
+// a warm page cache and, with --cold, --runs times with the corpus or
+// archive evicted from the page cache first: with drop_caches if we may
+// write it, otherwise with posix_fadvise(POSIX_FADV_DONTNEED) on every file
+// (which only drops clean pages, so the data is synced first).
+//
+// Per run: wall time, user and system CPU time, peak RSS and context
+// switches from wait4(), and the read / write syscall counts and bytes
+// from /proc/<pid>/io (Linux only).
+//
+// usage: asarbench [options] <corpus dir> <work dir>
+//   --asar=<path>     asar binary to run (default: ./asar)
+//   --runs=<n>        timed runs per operation and cache state (default: 3)
+//   --cold            also measure with a cold page cache
+//   --jobs=<n>        passed on to pack and extract
+//   --args=<options>  more options for pack, separated by spaces
+//   --extract-args=<options>
+//                     more options for extract, e.g. --io-uring
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+typedef struct {
+	double wall;
+	double user;
+	double sys;
+	long maxRssKb;
+	long ctxSwitches;
+	int64_t syscr = -1;  // -1 if /proc/<pid>/io isn't available
+	int64_t syscw = -1;
+	int64_t rchar = -1;
+	int64_t wchar = -1;
+} run_t;
+
+typedef struct {
+	uint64_t files = 0;
+	uint64_t dirs = 0;
+	uint64_t links = 0;
+	uint64_t bytes = 0;
+	std::vector<std::string> vFiles;  // relative paths of the regular files
+} corpus_t;
+
+static corpus_t corpus;
+static size_t corpusRootLen;
+static bool bDropCaches = true;
+
+static std::string jsonString( const std::string &s ) {
+	std::string r = "\"";
+
+	for ( unsigned char c : s ) {
+		if ( c == '"' || c == '\\' ) {
+			r += '\\';
+			r += c;
+		} else if ( c < 0x20 ) {
+			char buf[8];
+			snprintf( buf, sizeof(buf), "\\u%04x", c );
+			r += buf;
+		} else {
+			r += c;
+		}
+	}
+
+	return r + "\"";
+}
+
+static int scanEntry( const char *path, const struct stat *st, int type, struct FTW * ) {
+	if ( type == FTW_F ) {
+		corpus.files++;
+		corpus.bytes += st->st_size;
+		corpus.vFiles.push_back( path + corpusRootLen );
+	} else if ( type == FTW_SL ) {
+		corpus.links++;
+	} else if ( type == FTW_D ) {
+		corpus.dirs++;
+	}
+	return 0;
+}
+
+static int removeEntry( const char *path, const struct stat *, int type, struct FTW * ) {
+	if ( (type == FTW_DP ? rmdir(path) : unlink(path)) != 0 )
+		perror( path );
+	return 0;
+}
+
+static void removeTree( const std::string &sPath ) {
+	struct stat st;
+	if ( lstat(sPath.c_str(), &st) == 0 )
+		nftw( sPath.c_str(), removeEntry, 64, FTW_DEPTH | FTW_PHYS );
+}
+
+static int evictEntry( const char *path, const struct stat *, int type, struct FTW * ) {
+	if ( type == FTW_F ) {
+		int fd = open( path, O_RDONLY | O_CLOEXEC );
+		if ( fd != -1 ) {
+			posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+			close(fd);
+		}
+	}
+	return 0;
+}
+
+// get sPath (a file or a tree) out of the page cache
+static void evict( const std::string &sPath ) {
+	sync();
+
+	if ( bDropCaches ) {
+		int fd = open( "/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC );
+
+		if ( fd != -1 && write(fd, "1", 1) == 1 ) {
+			close(fd);
+			return;
+		}
+		if ( fd != -1 )
+			close(fd);
+		bDropCaches = false;
+	}
+
+	nftw( sPath.c_str(), evictEntry, 64, FTW_PHYS );
+}
+
+static bool readProcIo( pid_t pid, run_t &r ) {
+	std::ifstream ifs( "/proc/" + std::to_string(pid) + "/io" );
+	std::string sKey;
+	int64_t v;
+
+	while ( ifs >> sKey >> v ) {
+		if ( sKey == "syscr:" ) r.syscr = v;
+		else if ( sKey == "syscw:" ) r.syscw = v;
+		else if ( sKey == "rchar:" ) r.rchar = v;
+		else if ( sKey == "wchar:" ) r.wchar = v;
+	}
+
+	return r.syscr != -1;
+}
+
+// run argv in sDir with stdout discarded, false if it failed
+static bool runCommand( const std::vector<std::string> &vArgs, const std::string &sDir, run_t &r ) {
+	std::vector<char *> argv;
+	for ( const auto &a : vArgs )
+		argv.push_back( const_cast<char *>(a.c_str()) );
+	argv.push_back( NULL );
+
+	auto start = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+
+	if ( pid == -1 ) {
+		perror( "fork" );
+		return false;
+	}
+
+	if ( pid == 0 ) {
+		int fd = open( "/dev/null", O_WRONLY );
+		if ( fd != -1 )
+			dup2( fd, 1 );
+		if ( !sDir.empty() && chdir(sDir.c_str()) != 0 )
+			_exit(127);
+		execv( argv[0], argv.data() );
+		_exit(127);
+	}
+
+	// the exited child stays a zombie until wait4(),
+	// so its I/O accounting can still be read
+	siginfo_t si;
+	while ( waitid(P_PID, pid, &si, WEXITED | WNOWAIT) != 0 && errno == EINTR )
+		;
+	r.wall = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	readProcIo( pid, r );
+
+	int status;
+	struct rusage ru;
+
+	if ( wait4(pid, &status, 0, &ru) != pid )
+		return false;
+
+	r.user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+	r.sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	r.maxRssKb = ru.ru_maxrss;
+	r.ctxSwitches = ru.ru_nvcsw + ru.ru_nivcsw;
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+typedef struct {
+	std::string name;
+	std::vector<std::string> vArgs;
+	std::string sDir;      // working directory, created if needed
+	std::string sEvict;    // what to drop from the page cache for a cold run
+	std::string sClean;    // removed before every run
+	uint64_t bytes;        // payload bytes for the throughput
+} operation_t;
+
+static double median( std::vector<double> v ) {
+	std::sort( v.begin(), v.end() );
+	size_t n = v.size();
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static void printRun( std::ostream &os, const run_t &r, uint64_t bytes ) {
+	os << "{\"wall_s\": " << r.wall << ", \"user_s\": " << r.user << ", \"sys_s\": " << r.sys
+		<< ", \"mb_s\": " << (r.wall > 0 ? bytes / r.wall / 1e6 : 0)
+		<< ", \"max_rss_kb\": " << r.maxRssKb << ", \"ctx_switches\": " << r.ctxSwitches;
+
+	if ( r.syscr != -1 ) {
+		os << ", \"read_syscalls\": " << r.syscr << ", \"write_syscalls\": " << r.syscw
+			<< ", \"read_bytes\": " << r.rchar << ", \"write_bytes\": " << r.wchar;
+	}
+	os << "}";
+}
+
+// measure op, returns false if a run failed
+static bool measure( const operation_t &op, const char *cache, unsigned runs, bool &bFirst ) {
+	std::vector<run_t> vRuns;
+	run_t r;
+
+	std::cerr << op.name << " (" << cache << ")" << std::flush;
+
+	for ( unsigned i = 0; i <= runs; i++ ) {
+		// the first run only warms the cache
+		if ( i == 0 && strcmp(cache, "warm") != 0 )
+			continue;
+
+		if ( !op.sClean.empty() )
+			removeTree( op.sClean );
+		if ( !op.sDir.empty() )
+			mkdir( op.sDir.c_str(), 0755 );
+		if ( strcmp(cache, "cold") == 0 )
+			evict( op.sEvict );
+
+		if ( !runCommand(op.vArgs, op.sDir, r) ) {
+			std::cerr << " failed" << std::endl;
+			return false;
+		}
+		if ( i > 0 )
+			vRuns.push_back( r );
+		std::cerr << '.' << std::flush;
+	}
+	std::cerr << std::endl;
+
+	std::vector<double> vWall;
+	for ( const auto &x : vRuns )
+		vWall.push_back( x.wall );
+
+	double med = median( vWall );
+
+	std::cout << (bFirst ? "" : ",\n") << "    {\"op\": " << jsonString(op.name)
+		<< ", \"cache\": \"" << cache << "\", \"bytes\": " << op.bytes
+		<< ", \"wall_s\": {\"min\": " << *std::min_element(vWall.begin(), vWall.end())
+		<< ", \"median\": " << med << ", \"max\": " << *std::max_element(vWall.begin(), vWall.end())
+		<< "}, \"mb_s\": " << (med > 0 ? op.bytes / med / 1e6 : 0) << ",\n     \"runs\": [";
+
+	for ( size_t i = 0; i < vRuns.size(); i++ ) {
+		std::cout << (i ? ", " : "");
+		printRun( std::cout, vRuns[i], op.bytes );
+	}
+	std::cout << "]}";
+
+	bFirst = false;
+	return true;
+}
+
+static std::string absolute( const std::string &sPath ) {
+	char *p = realpath( sPath.c_str(), NULL );
+	std::string s = p ? p : sPath;
+	free(p);
+	return s;
+}
+
+static int usage( const char *argv0 ) {
+	std::cerr << "usage: " << argv0 << " [--asar=path] [--runs=n] [--cold] [--jobs=n] [--args=options]\n"
+		"       [--extract-args=options] <corpus dir> <work dir>" << std::endl;
+	return 1;
+}
+
+int main( int argc, char *argv[] ) {
+	std::string sAsar = "./asar", sJobs, sArgs, sExtractArgs;
+	unsigned runs = 3;
+	bool bCold = false;
+	int i;
+
+	// the last arguments are taken as paths, so look for these first
+	for ( i = 1; i < argc; i++ ) {
+		if ( strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ) {
+			usage(argv[0]);
+			return 0;
+		}
+	}
+
+	for ( i = 1; i < argc - 2; i++ ) {
+		if ( strncmp(argv[i], "--asar=", 7) == 0 )
+			sAsar = argv[i] + 7;
+		else if ( strncmp(argv[i], "--runs=", 7) == 0 && atoi(argv[i] + 7) > 0 )
+			runs = atoi(argv[i] + 7);
+		else if ( strcmp(argv[i], "--cold") == 0 )
+			bCold = true;
+		else if ( strncmp(argv[i], "--jobs=", 7) == 0 )
+			sJobs = argv[i];
+		else if ( strncmp(argv[i], "--args=", 7) == 0 )
+			sArgs = argv[i] + 7;
+		else if ( strncmp(argv[i], "--extract-args=", 15) == 0 )
+			sExtractArgs = argv[i] + 15;
+		else
+			return usage(argv[0]);
+	}
+
+	if ( i != argc - 2 || argv[i][0] == '-' || argv[i + 1][0] == '-' )
+		return usage(argv[0]);
+
+	std::string sCorpus = absolute( argv[i] );
+	std::string sWork = argv[i + 1];
+	sAsar = absolute( sAsar );
+
+	if ( mkdir(sWork.c_str(), 0755) != 0 && errno != EEXIST ) {
+		perror( sWork.c_str() );
+		return 1;
+	}
+	sWork = absolute( sWork );
+
+	corpusRootLen = sCorpus.size() + 1;
+	if ( nftw( sCorpus.c_str(), scanEntry, 64, FTW_PHYS ) != 0 || corpus.files == 0 ) {
+		std::cerr << "cannot read corpus: " << sCorpus << std::endl;
+		return 1;
+	}
+	std::sort( corpus.vFiles.begin(), corpus.vFiles.end() );
+
+	std::string sArchive = sWork + "/bench.asar";
+	std::string sOut = sWork + "/extract";
+	std::string sFileOut = sWork + "/extract-file";
+	std::string sFileList = sWork + "/files.txt";
+
+	// extract-file: 100 files spread over the archive
+	uint64_t fileBytes = 0;
+	{
+		std::ofstream ofs( sFileList );
+		size_t step = std::max<size_t>( corpus.vFiles.size() / 100, 1 );
+
+		for ( size_t j = 0; j < corpus.vFiles.size(); j += step ) {
+			struct stat st;
+			ofs << corpus.vFiles[j] << '\n';
+			if ( stat((sCorpus + "/" + corpus.vFiles[j]).c_str(), &st) == 0 )
+				fileBytes += st.st_size;
+		}
+	}
+
+	operation_t pack = { "pack", { sAsar, "pack" }, "", sCorpus, sArchive, corpus.bytes };
+	if ( !sJobs.empty() )
+		pack.vArgs.push_back( sJobs );
+	std::istringstream iss( sArgs );
+	for ( std::string s; iss >> s; )
+		pack.vArgs.push_back( s );
+	pack.vArgs.push_back( sCorpus );
+	pack.vArgs.push_back( sArchive );
+
+	// the archive of the last pack run is used by the others
+	struct stat st;
+	operation_t list = { "list", { sAsar, "list", sArchive }, "", sArchive, "", 0 };
+	operation_t extract = { "extract", { sAsar, "extract" }, "", sArchive, sOut, corpus.bytes };
+	if ( !sJobs.empty() )
+		extract.vArgs.push_back( sJobs );
+	std::istringstream issExtract( sExtractArgs );
+	for ( std::string s; issExtract >> s; )
+		extract.vArgs.push_back( s );
+	extract.vArgs.push_back( sArchive );
+	extract.vArgs.push_back( sOut );
+	operation_t extractFile = { "extract-file", { sAsar, "extract-file", "--files-from=" + sFileList, sArchive },
+		sFileOut, sArchive, sFileOut, fileBytes };
+
+	struct utsname un;
+	uname( &un );
+
+	std::cout << "{\n  \"machine\": {\"host\": " << jsonString(un.nodename) << ", \"system\": "
+		<< jsonString(std::string(un.sysname) + " " + un.release + " " + un.machine)
+		<< ", \"cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << "},\n"
+		<< "  \"asar\": " << jsonString(sAsar) << ",\n"
+		<< "  \"options\": " << jsonString(sJobs + (sJobs.empty() || sArgs.empty() ? "" : " ") + sArgs) << ",\n"
+		<< "  \"extract options\": " << jsonString(sExtractArgs) << ",\n"
+		<< "  \"corpus\": {\"path\": " << jsonString(sCorpus) << ", \"files\": " << corpus.files
+		<< ", \"dirs\": " << corpus.dirs << ", \"symlinks\": " << corpus.links
+		<< ", \"bytes\": " << corpus.bytes << "},\n"
+		<< "  \"results\": [\n";
+
+	bool bFirst = true;
+	bool ok = measure( pack, "warm", runs, bFirst ) && (!bCold || measure( pack, "cold", runs, bFirst ));
+
+	if ( ok && stat(sArchive.c_str(), &st) == 0 ) {
+		list.bytes = st.st_size;
+
+		ok = measure( list, "warm", runs, bFirst ) && (!bCold || measure( list, "cold", runs, bFirst )) &&
+			measure( extract, "warm", runs, bFirst ) && (!bCold || measure( extract, "cold", runs, bFirst )) &&
+			measure( extractFile, "warm", runs, bFirst ) && (!bCold || measure( extractFile, "cold", runs, bFirst ));
+	}
+
+	std::cout << "\n  ],\n  \"cold_cache\": \"" << (!bCold ? "off" : bDropCaches ? "drop_caches" : "fadvise")
+		<< "\"\n}" << std::endl;
+
+	removeTree( sOut );
+	removeTree( sFileOut );
+
+	return ok ? 0 : 1;
+}
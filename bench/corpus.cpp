@@ -0,0 +1,296 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Writes a synthetic directory tree to benchmark pack and extraction:
+//  - tiny:  many small files in a node_modules like layout, some of
+//           them executable, symbolic links or identical LICENSE files
+//           with a hard link each (COPYING)
+//  - blobs: a few big files
+//  - deep:  a deeply nested chain of directories
+//  - mixed: all of the above
+// The content is pseudo random (incompressible) and depends only on the
+// seed, so the same options give the same tree. A summary is printed as JSON.
+//
+// usage: corpus [options] <dir>
+//   --shape=<tiny|blobs|deep|mixed>  (default: mixed)
+//   --files=<n>                      number of tiny files (default: 200000)
+//   --blobs=<n>                      number of big files (default: 3)
+//   --blob-size=<n>[K|M|G]           size of a big file (default: 2G)
+//   --depth=<n>                      nesting of the deep tree (default: 64)
+//   --seed=<n>                       (default: 1)
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static const char license[] =
+	"Permission is hereby granted, free of charge, to any person obtaining a copy\n"
+	"of this software and associated documentation files (the \"Software\"), to deal\n"
+	"in the Software without restriction, including without limitation the rights\n"
+	"to use, copy, modify, merge, publish, distribute, sublicense, and/or sell\n"
+	"copies of the Software, and to permit persons to whom the Software is\n"
+	"furnished to do so, subject to the following conditions: ...\n";
+
+static const char *exts[] = { ".js", ".json", ".d.ts", ".map", ".css", ".png", ".node", ".md" };
+
+typedef struct {
+	uint64_t files = 0;
+	uint64_t dirs = 0;
+	uint64_t links = 0;
+	uint64_t hardlinks = 0;
+	uint64_t executables = 0;
+	uint64_t bytes = 0;
+} summary_t;
+
+static summary_t summary;
+static uint64_t state;
+
+// xorshift64*
+static uint64_t rnd() {
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 2685821657736338717ULL;
+}
+
+static void fill( char *buf, size_t size ) {
+	size_t i = 0;
+
+	for ( ; i + 8 <= size; i += 8 ) {
+		uint64_t v = rnd();
+		memcpy( buf + i, &v, 8 );
+	}
+	if ( i < size ) {
+		uint64_t v = rnd();
+		memcpy( buf + i, &v, size - i );
+	}
+}
+
+static void die( const std::string &s ) {
+	perror( s.c_str() );
+	exit(1);
+}
+
+static void makeDir( const std::string &sPath ) {
+	if ( mkdir(sPath.c_str(), 0755) != 0 && errno != EEXIST )
+		die( sPath );
+	summary.dirs++;
+}
+
+static void writeFile( const std::string &sPath, const char *data, size_t size, bool executable ) {
+	int fd = open( sPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, executable ? 0755 : 0644 );
+	if ( fd == -1 )
+		die( sPath );
+
+	summary.files++;
+	summary.bytes += size;
+	if ( executable )
+		summary.executables++;
+
+	while ( size > 0 ) {
+		ssize_t n = write( fd, data, size );
+		if ( n <= 0 )
+			die( sPath );
+		data += n;
+		size -= n;
+	}
+
+	close(fd);
+}
+
+static void makeLink( const std::string &sTarget, const std::string &sPath ) {
+	if ( symlink(sTarget.c_str(), sPath.c_str()) != 0 && errno != EEXIST )
+		die( sPath );
+	summary.links++;
+}
+
+static void makeHardLink( const std::string &sTarget, const std::string &sPath ) {
+	if ( link(sTarget.c_str(), sPath.c_str()) != 0 && errno != EEXIST )
+		die( sPath );
+	summary.hardlinks++;
+}
+
+// packages of 100 files each, a LICENSE and a hard link of it (the same
+// in every package, so pack --dedup shares them) and files mostly below 4 KiB
+static void makeTiny( const std::string &sDir, uint64_t count ) {
+	std::vector<char> buf(16384);
+	std::string sPkg;
+
+	makeDir( sDir );
+
+	for ( uint64_t i = 0; i < count; i++ ) {
+		if ( i % 100 == 0 ) {
+			sPkg = sDir + "/pkg" + std::to_string(i / 100);
+			makeDir( sPkg );
+			makeDir( sPkg + "/lib" );
+			writeFile( sPkg + "/LICENSE", license, sizeof(license) - 1, false );
+			makeHardLink( sPkg + "/LICENSE", sPkg + "/COPYING" );
+			continue;
+		}
+
+		std::string sName = "file" + std::to_string(i) + exts[ rnd() % 8 ];
+		size_t size = rnd() % 100 < 90 ? rnd() % 4096 : rnd() % 16384;
+		bool executable = ( i % 50 == 0 );
+
+		fill( buf.data(), size );
+		writeFile( sPkg + "/lib/" + sName, buf.data(), size, executable );
+
+		if ( i % 100 == 1 )
+			makeLink( "lib/" + sName, sPkg + "/main" + exts[0] );
+	}
+}
+
+static void makeBlobs( const std::string &sDir, uint64_t count, uint64_t size ) {
+	std::vector<char> buf(1024*1024);
+
+	makeDir( sDir );
+
+	for ( uint64_t i = 0; i < count; i++ ) {
+		std::string sPath = sDir + "/blob" + std::to_string(i) + ".bin";
+		int fd = open( sPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+		if ( fd == -1 )
+			die( sPath );
+
+		for ( uint64_t pos = 0; pos < size; ) {
+			size_t n = std::min<uint64_t>( size - pos, buf.size() );
+			fill( buf.data(), n );
+			if ( write(fd, buf.data(), n) != static_cast<ssize_t>(n) )
+				die( sPath );
+			pos += n;
+		}
+
+		close(fd);
+		summary.files++;
+		summary.bytes += size;
+	}
+}
+
+// a chain of directories with a file, an executable and a link at every level
+static void makeDeep( const std::string &sDir, unsigned depth ) {
+	std::vector<char> buf(8192);
+	std::string sPath = sDir;
+
+	for ( unsigned i = 0; i < depth; i++ ) {
+		makeDir( sPath );
+
+		size_t size = rnd() % buf.size();
+		fill( buf.data(), size );
+		writeFile( sPath + "/data" + std::to_string(i) + ".txt", buf.data(), size, false );
+		writeFile( sPath + "/run" + std::to_string(i) + ".sh", "#!/bin/sh\nexit 0\n", 17, true );
+
+		if ( i > 0 )
+			makeLink( "../data" + std::to_string(i - 1) + ".txt", sPath + "/parent" + std::to_string(i) + ".txt" );
+
+		sPath += "/d" + std::to_string(i);
+	}
+}
+
+static bool parseSize( const char *s, uint64_t &v ) {
+	char *end;
+	v = strtoull( s, &end, 10 );
+
+	switch ( *end ) {
+		case 'G': case 'g': v <<= 10;  // fall through
+		case 'M': case 'm': v <<= 10;  // fall through
+		case 'K': case 'k': v <<= 10; end++; break;
+		default: break;
+	}
+
+	return end != s && *end == 0;
+}
+
+static int usage( const char *argv0 ) {
+	std::cerr << "usage: " << argv0 << " [--shape=tiny|blobs|deep|mixed] [--files=n] [--blobs=n]\n"
+		"       [--blob-size=n[K|M|G]] [--depth=n] [--seed=n] <dir>" << std::endl;
+	return 1;
+}
+
+int main( int argc, char *argv[] ) {
+	std::string sShape = "mixed";
+	uint64_t files = 200000, blobs = 3, blobSize = 2ULL << 30, depth = 64, seed = 1;
+	int i;
+
+	// the last arguments are taken as paths, so look for these first
+	for ( i = 1; i < argc; i++ ) {
+		if ( strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ) {
+			usage(argv[0]);
+			return 0;
+		}
+	}
+
+	for ( i = 1; i < argc - 1; i++ ) {
+		const char *a = argv[i];
+		bool ok = true;
+
+		if ( strncmp(a, "--shape=", 8) == 0 )
+			sShape = a + 8;
+		else if ( strncmp(a, "--files=", 8) == 0 )
+			ok = parseSize( a + 8, files );
+		else if ( strncmp(a, "--blobs=", 8) == 0 )
+			ok = parseSize( a + 8, blobs );
+		else if ( strncmp(a, "--blob-size=", 12) == 0 )
+			ok = parseSize( a + 12, blobSize );
+		else if ( strncmp(a, "--depth=", 8) == 0 )
+			ok = parseSize( a + 8, depth );
+		else if ( strncmp(a, "--seed=", 7) == 0 )
+			ok = parseSize( a + 7, seed );
+		else
+			ok = false;
+
+		if ( !ok )
+			return usage(argv[0]);
+	}
+
+	if ( i != argc - 1 || argv[i][0] == '-' || (sShape != "tiny" && sShape != "blobs" && sShape != "deep" && sShape != "mixed") )
+		return usage(argv[0]);
+
+	std::string sDir = argv[i];
+	state = seed ? seed : 1;
+
+	makeDir( sDir );
+
+	if ( sShape == "tiny" || sShape == "mixed" )
+		makeTiny( sDir + "/node_modules", files );
+	if ( sShape == "blobs" || sShape == "mixed" )
+		makeBlobs( sDir + "/blobs", blobs, blobSize );
+	if ( sShape == "deep" || sShape == "mixed" )
+		makeDeep( sDir + "/deep", depth );
+
+	std::cout << "{\"shape\": \"" << sShape << "\", \"files\": " << summary.files
+		<< ", \"dirs\": " << summary.dirs << ", \"symlinks\": " << summary.links
+		<< ", \"hardlinks\": " << summary.hardlinks << ", \"executables\": " << summary.executables
+		<< ", \"bytes\": " << summary.bytes << "}" << std::endl;
+
+	return 0;
+}
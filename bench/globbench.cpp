@@ -0,0 +1,117 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Matches a list of synthetic paths against --unpack style patterns:
+//  - a std::regex constructed for every path (what pack used to do)
+//  - a std::regex constructed once
+//  - pathMatcher in regex mode
+//  - pathMatcher with an equivalent glob
+//
+// usage: globbench [number of paths]
+
+#include <chrono>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#include "../pathmatcher.h"
+
+
+static const char *dirs[] = { "src", "lib", "node_modules", "assets", "build", "test", "docs", "vendor" };
+static const char *exts[] = { ".js", ".json", ".node", ".png", ".css", ".map", ".txt", ".dll" };
+
+static void makePaths( size_t count, std::vector<std::string> &vPaths ) {
+	unsigned seed = 1;
+
+	vPaths.reserve( count );
+
+	for ( size_t i = 0; i < count; i++ ) {
+		std::string s;
+		int depth = 1 + (rand_r(&seed) % 5);
+
+		for ( int j = 0; j < depth; j++ ) {
+			s += dirs[ rand_r(&seed) % 8 ];
+			s += std::to_string( rand_r(&seed) % 16 );
+			s += '/';
+		}
+
+		s += "file" + std::to_string(i);
+		s += exts[ rand_r(&seed) % 8 ];
+		vPaths.push_back( s );
+	}
+}
+
+template<typename F>
+static void run( const char *name, const std::vector<std::string> &vPaths, F f ) {
+	auto t0 = std::chrono::steady_clock::now();
+	size_t n = 0;
+
+	for ( const auto &p : vPaths ) {
+		if ( f(p) )
+			n++;
+	}
+
+	auto t1 = std::chrono::steady_clock::now();
+	double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+	std::cout << name << ": " << ms << " ms, " << (ms * 1e6 / vPaths.size()) << " ns/path, "
+		<< n << " matches" << std::endl;
+}
+
+int main( int argc, char *argv[] ) {
+	size_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100000;
+	const char *re = ".*\\.(node|dll)";
+	const char *glob = "*.{node,dll}";
+	std::vector<std::string> vPaths;
+
+	makePaths( count, vPaths );
+
+	run( "std::regex per path ", vPaths, [re] (const std::string &p) {
+		return std::regex_match( p, std::regex(re) );
+	});
+
+	std::regex reOnce(re);
+	run( "std::regex once     ", vPaths, [&reOnce] (const std::string &p) {
+		return std::regex_match( p, reOnce );
+	});
+
+	pathMatcher pmRegex( true );
+	pmRegex.add( re );
+	pmRegex.compile();
+	run( "pathMatcher (regex) ", vPaths, [&pmRegex] (const std::string &p) {
+		return pmRegex.match( p );
+	});
+
+	pathMatcher pmGlob( false, true );
+	pmGlob.add( glob );
+	pmGlob.compile();
+	run( "pathMatcher (glob)  ", vPaths, [&pmGlob] (const std::string &p) {
+		return pmGlob.match( p );
+	});
+
+	return 0;
+}
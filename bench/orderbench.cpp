@@ -0,0 +1,301 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Startup reads with and without pack --ordering: a fixed random set of
+// --files files of the corpus (see corpus.cpp) is read in a fixed random
+// order through asarArchive::open() and readAll(), the way an application
+// reads its modules at startup. The order is recorded with
+// setRecordAccess() on an archive packed as usual, then the corpus is
+// packed again with that order as --ordering. Both archives are read
+// --runs times with the archive evicted from the page cache first
+// (drop_caches if we may write it, posix_fadvise() otherwise) and once
+// warm; the results are printed as JSON on stdout.
+//
+// usage: orderbench [options] <corpus dir> <work dir>
+//   --asar=<path>   asar binary used to pack (default: ./asar)
+//   --runs=<n>      cold runs per archive (default: 3)
+//   --files=<n>     files read at "startup" (default: 1000)
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../asar.h"
+
+
+static std::vector<std::string> vCorpus;  // relative paths of the regular files
+static size_t corpusRootLen;
+static bool bDropCaches = true;
+
+static int scanEntry( const char *path, const struct stat *, int type, struct FTW * ) {
+	if ( type == FTW_F )
+		vCorpus.push_back( path + corpusRootLen );
+	return 0;
+}
+
+static void evict( const std::string &sPath ) {
+	sync();
+
+	if ( bDropCaches ) {
+		int fd = open( "/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC );
+
+		if ( fd != -1 && write(fd, "1", 1) == 1 ) {
+			close(fd);
+			return;
+		}
+		if ( fd != -1 )
+			close(fd);
+		bDropCaches = false;
+	}
+
+	int fd = open( sPath.c_str(), O_RDONLY | O_CLOEXEC );
+	if ( fd != -1 ) {
+		posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+		close(fd);
+	}
+}
+
+// run argv with stdout discarded, false if it failed
+static bool runCommand( const std::vector<std::string> &vArgs ) {
+	std::vector<char *> argv;
+	for ( const auto &a : vArgs )
+		argv.push_back( const_cast<char *>(a.c_str()) );
+	argv.push_back( NULL );
+
+	pid_t pid = fork();
+
+	if ( pid == -1 ) {
+		perror( "fork" );
+		return false;
+	}
+
+	if ( pid == 0 ) {
+		int fd = open( "/dev/null", O_WRONLY );
+		if ( fd != -1 ) {
+			dup2( fd, 1 );
+			dup2( fd, 2 );
+		}
+		execv( argv[0], argv.data() );
+		_exit(127);
+	}
+
+	int status;
+	while ( waitpid(pid, &status, 0) != pid ) {
+		if ( errno != EINTR )
+			return false;
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+typedef struct {
+	double wall;
+	long majorFaults;
+	uint64_t bytes;
+} run_t;
+
+// open the archive and read vFiles in order
+static bool startup( const std::string &sArchive, const std::vector<std::string> &vFiles, run_t &r ) {
+	struct rusage before, after;
+	std::string sData;
+	asarArchive archive;
+
+	getrusage( RUSAGE_SELF, &before );
+	auto start = std::chrono::steady_clock::now();
+
+	if ( !archive.open(sArchive) )
+		return false;
+
+	r.bytes = 0;
+	for ( const auto &s : vFiles ) {
+		if ( !archive.readAll( s, sData ) ) {
+			std::cerr << "cannot read " << s << " from " << sArchive << std::endl;
+			return false;
+		}
+		r.bytes += sData.size();
+	}
+
+	archive.close();
+
+	r.wall = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	getrusage( RUSAGE_SELF, &after );
+	r.majorFaults = after.ru_majflt - before.ru_majflt;
+
+	return true;
+}
+
+static bool measure( const std::string &sName, const std::string &sArchive, const std::vector<std::string> &vFiles,
+	unsigned runs, bool &bFirst )
+{
+	std::vector<run_t> vRuns;
+	run_t warm;
+
+	std::cerr << sName << std::flush;
+
+	for ( unsigned i = 0; i < runs; i++ ) {
+		run_t r;
+		evict( sArchive );
+		if ( !startup( sArchive, vFiles, r ) )
+			return false;
+		vRuns.push_back( r );
+		std::cerr << '.' << std::flush;
+	}
+
+	if ( !startup( sArchive, vFiles, warm ) )
+		return false;
+	std::cerr << std::endl;
+
+	std::sort( vRuns.begin(), vRuns.end(), [] (const run_t &a, const run_t &b) { return a.wall < b.wall; } );
+	const run_t &med = vRuns[ vRuns.size() / 2 ];
+	struct stat st;
+	stat( sArchive.c_str(), &st );
+
+	std::cout << (bFirst ? "" : ",\n") << "    {\"archive\": \"" << sName << "\", \"archive_bytes\": " << st.st_size
+		<< ", \"read_bytes\": " << med.bytes
+		<< ", \"cold_wall_s\": {\"min\": " << vRuns.front().wall << ", \"median\": " << med.wall
+		<< ", \"max\": " << vRuns.back().wall << "}, \"cold_major_faults\": " << med.majorFaults
+		<< ", \"cold_mb_s\": " << (med.wall > 0 ? med.bytes / med.wall / 1e6 : 0)
+		<< ", \"warm_wall_s\": " << warm.wall << "}";
+
+	bFirst = false;
+	return true;
+}
+
+static std::string absolute( const std::string &sPath ) {
+	char *p = realpath( sPath.c_str(), NULL );
+	std::string s = p ? p : sPath;
+	free(p);
+	return s;
+}
+
+static int usage( const char *argv0 ) {
+	std::cerr << "usage: " << argv0 << " [--asar=path] [--runs=n] [--files=n] <corpus dir> <work dir>" << std::endl;
+	return 1;
+}
+
+int main( int argc, char *argv[] ) {
+	std::string sAsar = "./asar";
+	unsigned runs = 3;
+	size_t files = 1000;
+	int i;
+
+	// the last arguments are taken as paths, so look for these first
+	for ( i = 1; i < argc; i++ ) {
+		if ( strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ) {
+			usage(argv[0]);
+			return 0;
+		}
+	}
+
+	for ( i = 1; i < argc - 2; i++ ) {
+		if ( strncmp(argv[i], "--asar=", 7) == 0 )
+			sAsar = argv[i] + 7;
+		else if ( strncmp(argv[i], "--runs=", 7) == 0 && atoi(argv[i] + 7) > 0 )
+			runs = atoi(argv[i] + 7);
+		else if ( strncmp(argv[i], "--files=", 8) == 0 && atoi(argv[i] + 8) > 0 )
+			files = atoi(argv[i] + 8);
+		else
+			return usage(argv[0]);
+	}
+
+	if ( i != argc - 2 || argv[i][0] == '-' || argv[i + 1][0] == '-' )
+		return usage(argv[0]);
+
+	std::string sCorpus = absolute( argv[i] );
+	std::string sWork = argv[i + 1];
+	sAsar = absolute( sAsar );
+
+	if ( mkdir(sWork.c_str(), 0755) != 0 && errno != EEXIST ) {
+		perror( sWork.c_str() );
+		return 1;
+	}
+	sWork = absolute( sWork );
+
+	corpusRootLen = sCorpus.size() + 1;
+	if ( nftw( sCorpus.c_str(), scanEntry, 64, FTW_PHYS ) != 0 || vCorpus.empty() ) {
+		std::cerr << "cannot read corpus: " << sCorpus << std::endl;
+		return 1;
+	}
+
+	// the same files in the same order on every run
+	std::sort( vCorpus.begin(), vCorpus.end() );
+	std::shuffle( vCorpus.begin(), vCorpus.end(), std::mt19937(1) );
+	vCorpus.resize( std::min(files, vCorpus.size()) );
+
+	std::string sPlain = sWork + "/plain.asar";
+	std::string sOrdered = sWork + "/ordered.asar";
+	std::string sOrdering = sWork + "/ordering.txt";
+
+	std::cerr << "packing" << std::endl;
+	if ( !runCommand( { sAsar, "pack", sCorpus, sPlain } ) ) {
+		std::cerr << "pack failed" << std::endl;
+		return 1;
+	}
+
+	// record the order like an application would
+	{
+		asarArchive archive;
+		std::string sData;
+
+		archive.setRecordAccess( true );
+		if ( !archive.open(sPlain) )
+			return 1;
+		for ( const auto &s : vCorpus )
+			archive.readAll( s, sData );
+		archive.close();
+
+		if ( !archive.writeAccessOrder(sOrdering) )
+			return 1;
+	}
+
+	if ( !runCommand( { sAsar, "pack", "--ordering=" + sOrdering, sCorpus, sOrdered } ) ) {
+		std::cerr << "pack --ordering failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "{\n  \"corpus\": {\"path\": \"" << sCorpus << "\", \"startup_files\": " << vCorpus.size() << "},\n"
+		<< "  \"results\": [\n";
+
+	bool bFirst = true;
+	bool ok = measure( "plain", sPlain, vCorpus, runs, bFirst ) &&
+		measure( "ordered", sOrdered, vCorpus, runs, bFirst );
+
+	std::cout << "\n  ],\n  \"cold_cache\": \"" << (bDropCaches ? "drop_caches" : "fadvise") << "\"\n}" << std::endl;
+
+	return ok ? 0 : 1;
+}
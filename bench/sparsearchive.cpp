@@ -0,0 +1,311 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Writes an asar archive of several GiB that takes next to no disk space
+// or time: the big files are holes with a 4 KiB signature at their start
+// and end, and small files follow each of them, so there are offsets past
+// 2 and 4 GiB and, by default, big files of more than 4 GiB. The archive
+// is then read back through asarArchive: stat() of every file, the small
+// files whole and the signatures and a part of the holes of the big ones.
+// A summary is printed as JSON, the exit status is 1 if the check failed.
+// `asar list`, `extract-file` and `extract --include` work on it as well.
+//
+// usage: sparsearchive [options] <archive>
+//   --blobs=<n>               number of big files (default: 2)
+//   --blob-size=<n>[K|M|G]    size of a big file (default: 4.5 GiB + 4321)
+//   --no-check                only write the archive
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../asar.h"
+
+#define SIGNATURE_SIZE 4096
+
+
+typedef struct {
+	std::string path;
+	uint64_t size;
+	uint64_t offset;
+	std::string data;  // all of a small file, the head and tail of a big one
+	bool big;
+} file_t;
+
+// pseudo random bytes that depend on seed
+static std::string pattern( uint64_t seed, size_t size ) {
+	std::string s( size, '\0' );
+	uint64_t x = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+	for ( size_t i = 0; i < size; i++ ) {
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+		s[i] = static_cast<char>( x >> 56 );
+	}
+
+	return s;
+}
+
+static bool pwriteAll( int fd, const std::string &s, uint64_t offset ) {
+	size_t done = 0;
+
+	while ( done < s.size() ) {
+		ssize_t n = pwrite( fd, s.data() + done, s.size() - done, offset + done );
+		if ( n <= 0 )
+			return false;
+		done += n;
+	}
+
+	return true;
+}
+
+static bool writeArchive( const std::string &sPath, std::vector<file_t> &vFiles, uint64_t &total ) {
+	// the header, names need no escaping; README.txt comes first and
+	// the rest are in models/
+	std::string sHeader = "{\"files\":{";
+
+	for ( size_t i = 0; i < vFiles.size(); i++ ) {
+		const file_t &f = vFiles[i];
+		std::string sName = f.path.substr( f.path.rfind('/') + 1 );
+
+		if ( i == 1 )
+			sHeader += ",\"models\":{\"files\":{";
+		else if ( i > 1 )
+			sHeader += ',';
+
+		sHeader += "\"" + sName + "\":{\"size\":" + std::to_string(f.size) +
+			",\"offset\":\"" + std::to_string(f.offset) + "\"}";
+	}
+	sHeader += "}}}}";
+
+	// the 16 byte prefix of sizes, little endian
+	uint32_t prefix[4] = { 4, static_cast<uint32_t>(sHeader.size() + 8),
+		static_cast<uint32_t>(sHeader.size() + 4), static_cast<uint32_t>(sHeader.size()) };
+	std::string sPrefix( 16, '\0' );
+	for ( int i = 0; i < 16; i++ )
+		sPrefix[i] = static_cast<char>( prefix[i / 4] >> (8 * (i % 4)) );
+
+	uint64_t dataPos = 16 + sHeader.size();
+	total = dataPos + vFiles.back().offset + vFiles.back().size;
+
+	int fd = open( sPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+	if ( fd == -1 ) {
+		perror( sPath.c_str() );
+		return false;
+	}
+
+	// the big files stay holes but for their signatures
+	bool ok = ftruncate( fd, total ) == 0 && pwriteAll( fd, sPrefix, 0 ) && pwriteAll( fd, sHeader, 16 );
+
+	for ( const auto &f : vFiles ) {
+		if ( !ok )
+			break;
+
+		if ( f.big ) {
+			size_t head = std::min<uint64_t>( f.size, SIGNATURE_SIZE );
+			ok = pwriteAll( fd, f.data.substr(0, head), dataPos + f.offset ) &&
+				pwriteAll( fd, f.data.substr(head), dataPos + f.offset + f.size - (f.data.size() - head) );
+		} else {
+			ok = pwriteAll( fd, f.data, dataPos + f.offset );
+		}
+	}
+
+	if ( close(fd) != 0 || !ok ) {
+		perror( sPath.c_str() );
+		return false;
+	}
+
+	return true;
+}
+
+static bool fail( const file_t &f, const char *what ) {
+	std::cerr << f.path << ": " << what << std::endl;
+	return false;
+}
+
+static bool checkArchive( const std::string &sPath, const std::vector<file_t> &vFiles ) {
+	asarArchive archive;
+	asarArchive::fileEntry_t entry;
+	bool ok = true;
+
+	if ( !archive.open(sPath) )
+		return false;
+
+	for ( const auto &f : vFiles ) {
+		if ( !archive.stat( f.path, entry ) ) {
+			ok = fail( f, "not found" );
+			continue;
+		}
+		if ( entry.size != f.size || entry.offset != f.offset ) {
+			ok = fail( f, "wrong size or offset" );
+			continue;
+		}
+
+		if ( !f.big ) {
+			std::string sData;
+			if ( !archive.readAll( f.path, sData ) || sData != f.data )
+				ok = fail( f, "wrong content" );
+			continue;
+		}
+
+		// head, tail and a bit of the hole in the middle
+		size_t head = std::min<uint64_t>( f.size, SIGNATURE_SIZE );
+		size_t tail = f.data.size() - head;
+		std::vector<char> vBuf( SIGNATURE_SIZE );
+
+		if ( archive.read( f.path, 0, head, vBuf.data() ) != static_cast<int64_t>(head) ||
+				memcmp( vBuf.data(), f.data.data(), head ) != 0 )
+			ok = fail( f, "wrong start" );
+
+		if ( archive.read( f.path, f.size - tail, tail, vBuf.data() ) != static_cast<int64_t>(tail) ||
+				memcmp( vBuf.data(), f.data.data() + head, tail ) != 0 )
+			ok = fail( f, "wrong end" );
+
+		if ( f.size >= 3 * SIGNATURE_SIZE ) {
+			std::vector<char> vZeros( SIGNATURE_SIZE, 0 );
+			if ( archive.read( f.path, f.size / 2, SIGNATURE_SIZE, vBuf.data() ) != SIGNATURE_SIZE ||
+					memcmp( vBuf.data(), vZeros.data(), SIGNATURE_SIZE ) != 0 )
+				ok = fail( f, "wrong data in the middle" );
+		}
+
+		// reading past the end gives what is left
+		if ( archive.read( f.path, f.size - 1, 2, vBuf.data() ) != 1 )
+			ok = fail( f, "wrong read at the end" );
+	}
+
+	archive.close();
+	return ok;
+}
+
+static bool parseSize( const char *s, uint64_t &v ) {
+	char *end;
+	v = strtoull( s, &end, 10 );
+
+	switch ( *end ) {
+		case 'G': case 'g': v <<= 10;  // fall through
+		case 'M': case 'm': v <<= 10;  // fall through
+		case 'K': case 'k': v <<= 10; end++; break;
+		default: break;
+	}
+
+	return end != s && *end == 0;
+}
+
+static int usage( const char *argv0 ) {
+	std::cerr << "usage: " << argv0 << " [--blobs=n] [--blob-size=n[K|M|G]] [--no-check] <archive>" << std::endl;
+	return 1;
+}
+
+int main( int argc, char *argv[] ) {
+	uint64_t blobs = 2, blobSize = (9ULL << 29) + 4321;
+	bool bCheck = true;
+	int i;
+
+	// the last arguments are taken as paths, so look for these first
+	for ( i = 1; i < argc; i++ ) {
+		if ( strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ) {
+			usage(argv[0]);
+			return 0;
+		}
+	}
+
+	for ( i = 1; i < argc - 1; i++ ) {
+		const char *a = argv[i];
+		bool ok = true;
+
+		if ( strncmp(a, "--blobs=", 8) == 0 )
+			ok = parseSize( a + 8, blobs ) && blobs > 0;
+		else if ( strncmp(a, "--blob-size=", 12) == 0 )
+			ok = parseSize( a + 12, blobSize );
+		else if ( strcmp(a, "--no-check") == 0 )
+			bCheck = false;
+		else
+			ok = false;
+
+		if ( !ok )
+			return usage(argv[0]);
+	}
+
+	if ( i != argc - 1 || argv[i][0] == '-' )
+		return usage(argv[0]);
+
+	std::string sArchive = argv[i];
+
+	// a small file first, then every big file followed by a small one
+	std::vector<file_t> vFiles;
+	uint64_t offset = 0;
+
+	auto add = [&] ( const std::string &sPath, uint64_t size, const std::string &sData, bool big ) {
+		vFiles.push_back( { sPath, size, offset, sData, big } );
+		offset += size;
+	};
+
+	std::string sReadme = "sparse test archive\n";
+	add( "README.txt", sReadme.size(), sReadme, false );
+
+	for ( uint64_t b = 0; b < blobs; b++ ) {
+		std::string sName = "models/model" + std::to_string(b);
+		size_t sig = std::min<uint64_t>( blobSize, 2 * SIGNATURE_SIZE );
+		add( sName + ".bin", blobSize, pattern( b + 1, sig ), true );
+
+		std::string sText = "model " + std::to_string(b) + ": " + std::to_string(blobSize) +
+			" bytes at offset " + std::to_string(vFiles.back().offset) + "\n";
+		add( sName + ".txt", sText.size(), sText, false );
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	uint64_t total;
+
+	if ( !writeArchive( sArchive, vFiles, total ) )
+		return 1;
+
+	double writeTime = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	double checkTime = 0;
+	bool ok = true;
+
+	if ( bCheck ) {
+		start = std::chrono::steady_clock::now();
+		ok = checkArchive( sArchive, vFiles );
+		checkTime = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	}
+
+	struct stat st;
+	stat( sArchive.c_str(), &st );
+
+	std::cout << "{\"archive\": \"" << sArchive << "\", \"bytes\": " << total
+		<< ", \"disk_bytes\": " << static_cast<uint64_t>(st.st_blocks) * 512 << ", \"files\": " << vFiles.size()
+		<< ", \"last_offset\": " << vFiles.back().offset << ", \"write_s\": " << writeTime
+		<< ", \"check_s\": " << checkTime << ", \"check\": \"" << (!bCheck ? "skipped" : ok ? "ok" : "failed")
+		<< "\"}" << std::endl;
+
+	return ok ? 0 : 1;
+}
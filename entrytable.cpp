@@ -0,0 +1,287 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "entrytable.h"
+
+#ifdef _WIN32
+# define IS_DIR_SEPARATOR(x) (x=='\\' || x=='/')
+#else
+# define IS_DIR_SEPARATOR(x) (x=='/')
+#endif
+
+
+const uint32_t entryTable::NONE;
+
+void entryTable::clear() {
+	m_vEntries.clear();
+	m_vArena.clear();
+	m_vIndex.clear();
+}
+
+void entryTable::reserve( size_t entries, size_t arenaBytes ) {
+	m_vEntries.reserve( entries );
+	m_vArena.reserve( arenaBytes );
+}
+
+uint32_t entryTable::add( uint32_t parent, const char *name, size_t len, char type ) {
+	entry_t e;
+
+	e.size = 0;
+	e.offset = 0;
+	e.parent = parent;
+	e.name = m_vArena.size();
+	e.link = NONE;
+	e.type = type;
+	e.shared = false;
+
+	m_vArena.insert( m_vArena.end(), name, name + len );
+	m_vArena.push_back( 0 );
+	m_vEntries.push_back( e );
+
+	return m_vEntries.size() - 1;
+}
+
+void entryTable::setLink( uint32_t i, const char *target, size_t len ) {
+	m_vEntries[i].link = m_vArena.size();
+	m_vArena.insert( m_vArena.end(), target, target + len );
+	m_vArena.push_back( 0 );
+}
+
+void entryTable::pop_back() {
+	// its link target follows the name
+	m_vArena.resize( m_vEntries.back().name );
+	m_vEntries.pop_back();
+}
+
+const char *entryTable::link( size_t i ) const {
+	uint32_t pos = m_vEntries[i].link;
+	return pos == NONE ? "" : &m_vArena[pos];
+}
+
+void entryTable::appendPath( size_t i, std::string &s ) const {
+	uint32_t parent = m_vEntries[i].parent;
+
+	if ( parent != NONE ) {
+		appendPath( parent, s );
+		s.push_back( '/' );
+	}
+	s.append( name(i) );
+}
+
+std::string entryTable::path( size_t i ) const {
+	std::string s;
+	appendPath( i, s );
+	return s;
+}
+
+// FNV-1a over the parent index and the name
+uint64_t entryTable::hash( uint32_t parent, const char *name, size_t len ) {
+	uint64_t h = 14695981039346656037ULL;
+
+	for ( int i = 0; i < 4; i++ ) {
+		h ^= (parent >> (i * 8)) & 0xff;
+		h *= 1099511628211ULL;
+	}
+	for ( size_t i = 0; i < len; i++ ) {
+		h ^= static_cast<unsigned char>( name[i] );
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+void entryTable::buildIndex() {
+	size_t slots = 16;
+
+	// at most half full
+	while ( slots < m_vEntries.size() * 2 )
+		slots *= 2;
+
+	m_vIndex.assign( slots, NONE );
+
+	for ( size_t i = 0; i < m_vEntries.size(); i++ ) {
+		const char *p = name(i);
+		size_t pos = hash( m_vEntries[i].parent, p, strlen(p) ) & (slots - 1);
+
+		while ( m_vIndex[pos] != NONE )
+			pos = (pos + 1) & (slots - 1);
+		m_vIndex[pos] = i;
+	}
+}
+
+uint32_t entryTable::findChild( uint32_t parent, const char *name, size_t len ) const {
+	size_t mask = m_vIndex.size() - 1;
+	size_t pos = hash( parent, name, len ) & mask;
+
+	for ( ; m_vIndex[pos] != NONE; pos = (pos + 1) & mask ) {
+		uint32_t i = m_vIndex[pos];
+		const char *p = this->name(i);
+
+		if ( m_vEntries[i].parent == parent && strncmp(p, name, len) == 0 && p[len] == 0 )
+			return i;
+	}
+
+	return NONE;
+}
+
+uint32_t entryTable::find( uint32_t parent, const char *name, size_t len ) const {
+	return m_vIndex.empty() ? NONE : findChild( parent, name, len );
+}
+
+uint32_t entryTable::find( const std::string &sPath ) const {
+	uint32_t i = NONE;
+	size_t pos = 0;
+
+	if ( m_vIndex.empty() )
+		return NONE;
+
+	while ( pos < sPath.size() && IS_DIR_SEPARATOR(sPath[pos]) )
+		pos++;
+	if ( pos == sPath.size() )
+		return NONE;
+
+	while ( pos < sPath.size() ) {
+		size_t end = pos;
+
+		while ( end < sPath.size() && !IS_DIR_SEPARATOR(sPath[end]) )
+			end++;
+
+		i = findChild( i, sPath.data() + pos, end - pos );
+		if ( i == NONE )
+			return NONE;
+
+		pos = end + 1;
+	}
+
+	return i;
+}
+
+// an entry in the image of serialize(), followed by the
+// arena and the index
+typedef struct {
+	uint64_t size;
+	uint64_t offset;
+	uint32_t parent;
+	uint32_t name;
+	uint32_t link;
+	uint32_t type;
+} record_t;
+
+// numbers of entries, arena bytes and index slots
+typedef struct {
+	uint64_t entries;
+	uint64_t arena;
+	uint64_t index;
+} imageHeader_t;
+
+void entryTable::serialize( std::string &s ) const {
+	imageHeader_t h = { m_vEntries.size(), m_vArena.size(), m_vIndex.size() };
+	size_t pos = s.size();
+
+	s.resize( pos + sizeof(h) + h.entries * sizeof(record_t) + h.arena + h.index * sizeof(uint32_t) );
+	char *p = &s[pos];
+
+	memcpy( p, &h, sizeof(h) );
+	p += sizeof(h);
+
+	for ( const auto &e : m_vEntries ) {
+		record_t r = { e.size, e.offset, e.parent, e.name, e.link, static_cast<uint32_t>(e.type) };
+		memcpy( p, &r, sizeof(r) );
+		p += sizeof(r);
+	}
+
+	if ( h.arena > 0 )
+		memcpy( p, m_vArena.data(), h.arena );
+	p += h.arena;
+	if ( h.index > 0 )
+		memcpy( p, m_vIndex.data(), h.index * sizeof(uint32_t) );
+}
+
+bool entryTable::load( const char *data, size_t size ) {
+	imageHeader_t h;
+
+	clear();
+
+	if ( size < sizeof(h) )
+		return false;
+	memcpy( &h, data, sizeof(h) );
+	data += sizeof(h);
+	size -= sizeof(h);
+
+	// the index has a free slot, names are NUL-terminated and
+	// directories come before their members
+	if ( h.entries >= NONE || h.arena >= NONE || h.index > NONE ||
+		(h.index > 0 && ((h.index & (h.index - 1)) != 0 || h.index <= h.entries)) ||
+		size != h.entries * sizeof(record_t) + h.arena + h.index * sizeof(uint32_t) ||
+		(h.arena > 0 && data[size - h.index * sizeof(uint32_t) - 1] != 0) )
+	{
+		return false;
+	}
+
+	m_vEntries.resize( h.entries );
+
+	for ( size_t i = 0; i < h.entries; i++ ) {
+		record_t r;
+		memcpy( &r, data, sizeof(r) );
+		data += sizeof(r);
+
+		if ( (r.parent != NONE && r.parent >= i) || r.name >= h.arena || (r.link != NONE && r.link >= h.arena) ||
+			(r.type != 'F' && r.type != 'X' && r.type != 'L' && r.type != 'D') ||
+			(r.parent != NONE && m_vEntries[r.parent].type != 'D') )
+		{
+			clear();
+			return false;
+		}
+
+		entry_t &e = m_vEntries[i];
+		e.size = r.size;
+		e.offset = r.offset;
+		e.parent = r.parent;
+		e.name = r.name;
+		e.link = r.link;
+		e.type = static_cast<char>(r.type);
+		e.shared = false;
+	}
+
+	m_vArena.assign( data, data + h.arena );
+	data += h.arena;
+	m_vIndex.resize( h.index );
+	if ( h.index > 0 )
+		memcpy( m_vIndex.data(), data, h.index * sizeof(uint32_t) );
+
+	for ( const auto i : m_vIndex ) {
+		if ( i != NONE && i >= h.entries ) {
+			clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+size_t entryTable::memory() const {
+	return m_vEntries.capacity() * sizeof(entry_t) + m_vArena.capacity() + m_vIndex.capacity() * sizeof(uint32_t);
+}
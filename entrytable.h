@@ -0,0 +1,107 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ENTRYTABLE_H_INCLUDED
+#define ENTRYTABLE_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Compact list of the entries of an archive. Names and link targets are
+// stored once, NUL-terminated, in a single arena and every entry refers
+// to its parent directory by index, so a million entries don't need a
+// million path strings; full paths are only built by path(). Directories
+// are entries too and always come before their members. The arena is
+// addressed with 32 bits, which is plenty as the JSON header that the
+// names come from is limited to 4 GiB itself.
+class entryTable {
+
+public:
+	static const uint32_t NONE = 0xffffffff;
+
+	typedef struct {
+		uint64_t size;    // bytes of a file, number of members of a directory
+		uint64_t offset;  // of the data, from the end of the header
+		uint32_t parent;  // index of the directory, NONE at the top
+		uint32_t name;    // position of the name in the arena
+		uint32_t link;    // position of the link target, NONE if no link
+		char type;        // 'F' regular file
+		                  // 'L' symbolic link
+		                  // 'X' executable file
+		                  // 'D' directory
+		bool shared;      // pack: the data is already stored at offset for an earlier file
+	} entry_t;
+
+	size_t size() const { return m_vEntries.size(); }
+	bool empty() const { return m_vEntries.empty(); }
+	void clear();
+	void reserve( size_t entries, size_t arenaBytes );
+
+	entry_t &operator[]( size_t i ) { return m_vEntries[i]; }
+	const entry_t &operator[]( size_t i ) const { return m_vEntries[i]; }
+
+	// append an entry, returns its index
+	uint32_t add( uint32_t parent, const char *name, size_t len, char type );
+	void setLink( uint32_t i, const char *target, size_t len );
+	// remove the last entry, not after buildIndex()
+	void pop_back();
+
+	const char *name( size_t i ) const { return &m_vArena[ m_vEntries[i].name ]; }
+	const char *link( size_t i ) const;
+
+	// "dir/sub/name", appended to s
+	void appendPath( size_t i, std::string &s ) const;
+	std::string path( size_t i ) const;
+
+	// Path lookup: buildIndex() hashes all entries by parent and name,
+	// find() then returns the entry of a path or NONE. Leading separators
+	// are ignored, '\' also separates on Windows.
+	void buildIndex();
+	uint32_t find( const std::string &sPath ) const;
+	uint32_t find( uint32_t parent, const char *name, size_t len ) const;
+
+	// Binary image of the table and its index for an index file:
+	// serialize() appends it to s, load() replaces the table with an image
+	// and returns false if it is damaged.
+	void serialize( std::string &s ) const;
+	bool load( const char *data, size_t size );
+
+	// bytes allocated for the table
+	size_t memory() const;
+
+private:
+	std::vector<entry_t> m_vEntries;
+	std::vector<char> m_vArena;
+	std::vector<uint32_t> m_vIndex;  // open addressing, entry indices or NONE
+
+	static uint64_t hash( uint32_t parent, const char *name, size_t len );
+	uint32_t findChild( uint32_t parent, const char *name, size_t len ) const;
+
+};
+
+#endif // ENTRYTABLE_H_INCLUDED
@@ -25,7 +25,10 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <fstream>
 #include <regex>
+#include <cstdlib>
 #include "asar.h"
 
 // https://en.cppreference.com/w/cpp/regex/error_type
@@ -64,6 +67,55 @@ static bool regex_check(const char *expr) {
 	return true;
 }
 
+static bool parseJobs(const char *arg, asarArchive &archive) {
+	char *end;
+	long jobs = strtol(arg, &end, 10);
+
+	if ( *end != 0 || jobs < 0 || jobs > 1024 )
+		return false;
+
+	archive.setJobs( jobs );
+	return true;
+}
+
+// --index or --index=<dir>
+static bool parseIndex(const char *arg, asarArchive &archive) {
+	if ( strcmp(arg, "--index") == 0 )
+		archive.setIndex( true );
+	else if ( strncmp(arg, "--index=", 8) == 0 && strlen(arg) > 8 )
+		archive.setIndex( true, arg + 8 );
+	else
+		return false;
+
+	return true;
+}
+
+// read one path per line from a file or stdin ("-")
+static bool readFileList(const char *file, std::vector<std::string> &vFiles) {
+	std::ifstream ifs;
+	std::istream *is = &std::cin;
+
+	if ( strcmp(file, "-") != 0 ) {
+		ifs.open(file);
+		if ( !ifs ) {
+			std::cerr << "cannot open file: " << file << std::endl;
+			return false;
+		}
+		is = &ifs;
+	}
+
+	std::string line;
+
+	while ( std::getline(*is, line) ) {
+		if ( !line.empty() && line.back() == '\r' )
+			line.pop_back();
+		if ( !line.empty() )
+			vFiles.push_back( line );
+	}
+
+	return true;
+}
+
 static int printHelp(const char *argv0) {
 	std::cout <<
 		"Usage: " << argv0 << " [command] [options]\n"
@@ -75,14 +127,70 @@ static int printHelp(const char *argv0) {
 		"\n"
 		"Commands:\n"
 		"  pack|p [options] <dir> <output>       create asar archive\n"
-		"  list|l <archive>                      list files of asar archive\n"
-		"  extract-file|ef <archive> <filename>  extract one file from archive\n"
-		"  extract|e <archive> <dest>            extract archive\n"
+		"  pack|p --from-tar=<tar> [options] <output>\n"
+		"                                        create asar archive from a tar file\n"
+		"  list|l [options] <archive>            list files of asar archive\n"
+		"  extract-file|ef [options] <archive> <filename>...\n"
+		"                                        extract files from archive\n"
+		"  extract|e [options] <archive> <dest> [<path>...]\n"
+		"                                        extract archive, or only <path>s\n"
+		"  extract|e --to-tar=<tar> [options] <archive> [<path>...]\n"
+		"                                        write archive, or only <path>s, as tar file\n"
+		"  verify|v [options] <archive>          check the integrity hashes of archive\n"
+		"  profile|pr <archive> <log> <ordering> write the files of archive in the order\n"
+		"                                        an strace log reads them, for --ordering\n"
 		"\n"
 		"Options for command `pack':\n"
 		"  --unpack=<expression>      do not pack files matching glob <expression>\n"
 		"  --unpack-dir=<expression>  do not pack dirs matching glob <expression>\n"
+		"                             (both can be given more than once)\n"
+		"  --regex                    <expression> is an ECMAScript regular expression\n"
+		"                             matched against the full path instead of a glob\n"
 		"  --exclude-hidden           exclude hidden files\n"
+		"  --integrity                store SHA-256 hashes of the files like upstream asar\n"
+		"  --dedup                    store files with identical content only once\n"
+		"  --base=<archive>           copy unchanged files from a previous build of the\n"
+		"                             archive instead of reading them from <dir>; files\n"
+		"                             are compared by the hashes of its --integrity data\n"
+		"  --base-trust-mtime         if <archive> has no hashes, take files older than it\n"
+		"                             as unchanged (wrong if <archive> was copied or\n"
+		"                             restored after the files were edited)\n"
+		"  --from-tar=<tar>           read the files from tar file <tar> (\"-\" is stdin)\n"
+		"  --ordering=<file>          put the data of the files listed in <file> first,\n"
+		"                             in that order (like upstream asar)\n"
+		"  --jobs=<n>                 number of worker threads (default: number of CPUs)\n"
+		"  --stats                    print statistics to stderr\n"
+		"  --trace=<file>             write a Chrome trace (chrome://tracing) to <file>\n"
+		"\n"
+		"Options for command `extract':\n"
+		"  --include=<expression>     only extract files matching glob <expression>\n"
+		"  --exclude=<expression>     do not extract files and dirs matching glob <expression>\n"
+		"                             (both can be given more than once)\n"
+		"  --regex                    <expression> is an ECMAScript regular expression\n"
+		"                             matched against the full path instead of a glob\n"
+		"  --to-tar=<tar>             write the files to tar file <tar> (\"-\" is stdout)\n"
+		"                             in the order of their data instead of extracting\n"
+		"  --jobs=<n>                 number of worker threads (default: number of CPUs)\n"
+		"  --io-uring                 extract small files through io_uring (Linux 5.15+)\n"
+		"  --no-cache-pollution       drop the archive and the extracted files from the\n"
+		"                             page cache as they are done (slower)\n"
+		"  --stats                    print statistics to stderr\n"
+		"  --trace=<file>             write a Chrome trace (chrome://tracing) to <file>\n"
+		"\n"
+		"Command `profile' reads the log of e.g.\n"
+		"  strace -f -e trace=open,openat,read,pread64,lseek,close,dup -o <log> <program>\n"
+		"(\"-\" reads stdin), <ordering> \"-\" is stdout.\n"
+		"\n"
+		"Options for command `verify':\n"
+		"  --jobs=<n>                 number of worker threads (default: number of CPUs)\n"
+		"\n"
+		"Options for command `extract-file':\n"
+		"  --files-from=<file>        also extract the files listed in <file>,\n"
+		"                             one per line (\"-\" reads from stdin)\n"
+		"\n"
+		"Options for commands `list' and `extract-file':\n"
+		"  --index[=<dir>]            keep a binary index of the header in <archive>.idx\n"
+		"                             or in <dir> and use it while the archive is unchanged\n"
 		<< std::endl;
 	return 1;
 }
@@ -115,61 +223,275 @@ int main( int argc, char *argv[] ) {
 	if ( strcmp(argv[1], "p") == 0 || strcmp(argv[1], "pack") == 0 ) {
 		int shift = 0;
 		bool excludeHidden = false;
-		const char *unpack = NULL;
-		const char *unpackDir = NULL;
+		bool stats = false;
+		bool bRegex = false;
+		bool bBaseTrustMtime = false;
+		std::string sTrace, sFromTar, sBase;
+		std::vector<std::string> vUnpack, vUnpackDir;
 
 		if ( argc < 4 )
 			return printHelp(argv[0]);
-		else if ( argc > 4 ) {
-			for (int i = 2; i < argc - 2; i++) {
+		else {
+			for (int i = 2; i < argc - 1 && strncmp(argv[i], "--", 2) == 0; i++) {
 				if ( strcmp(argv[i], "--exclude-hidden") == 0 ) {
 					excludeHidden = true;
 					shift++;
+				} else if ( strcmp(argv[i], "--stats") == 0 ) {
+					stats = true;
+					shift++;
+				} else if ( strncmp(argv[i], "--trace=", 8) == 0 && strlen(argv[i]) > 8 ) {
+					sTrace = argv[i] + 8;
+					shift++;
+				} else if ( strcmp(argv[i], "--integrity") == 0 ) {
+					archive.setIntegrity( true );
+					shift++;
+				} else if ( strcmp(argv[i], "--dedup") == 0 ) {
+					archive.setDedup( true );
+					shift++;
+				} else if ( strncmp(argv[i], "--jobs=", 7) == 0 && strlen(argv[i]) > 7 ) {
+					if ( !parseJobs( argv[i] + 7, archive ) )
+						return printHelp(argv[0]);
+					shift++;
 				} else if ( strncmp(argv[i], "--unpack=", 9) == 0 && strlen(argv[i]) > 9 ) {
-					unpack = argv[i] + 9;
+					vUnpack.push_back( argv[i] + 9 );
 					shift++;
 				} else if ( strncmp(argv[i], "--unpack-dir=", 13) == 0 && strlen(argv[i]) > 13 ) {
-					unpackDir = argv[i] + 13;
+					vUnpackDir.push_back( argv[i] + 13 );
+					shift++;
+				} else if ( strcmp(argv[i], "--regex") == 0 ) {
+					bRegex = true;
+					shift++;
+				} else if ( strncmp(argv[i], "--base=", 7) == 0 && strlen(argv[i]) > 7 ) {
+					sBase = argv[i] + 7;
+					shift++;
+				} else if ( strcmp(argv[i], "--base-trust-mtime") == 0 ) {
+					bBaseTrustMtime = true;
+					shift++;
+				} else if ( strncmp(argv[i], "--ordering=", 11) == 0 && strlen(argv[i]) > 11 ) {
+					archive.setOrdering( argv[i] + 11 );
+					shift++;
+				} else if ( strncmp(argv[i], "--from-tar=", 11) == 0 && strlen(argv[i]) > 11 ) {
+					sFromTar = argv[i] + 11;
 					shift++;
 				} else
 					return printHelp(argv[0]);
 			}
 		}
 
-		// check regex for errors
-		if ( (unpack && !regex_check(unpack)) || (unpackDir && !regex_check(unpackDir)) )
-			return 1;
+		// the files come from the tar file instead of <dir>
+		int positional = sFromTar.empty() ? 2 : 1;
+
+		if ( argc != 2 + shift + positional || (bBaseTrustMtime && sBase.empty()) )
+			return printHelp(argv[0]);
+
+		archive.setBaseArchive( sBase, bBaseTrustMtime );
+
+		// files are also matched by their basename, like minimatch's matchBase
+		pathMatcher unpack( bRegex, true );
+		pathMatcher unpackDir( bRegex, false );
+
+		for ( const auto &e : vUnpack ) {
+			// check regex for errors
+			if ( bRegex && !regex_check(e.c_str()) )
+				return 1;
+			if ( !unpack.add(e) ) {
+				std::cerr << "invalid pattern: " << e << std::endl;
+				return 1;
+			}
+		}
+
+		for ( const auto &e : vUnpackDir ) {
+			if ( bRegex && !regex_check(e.c_str()) )
+				return 1;
+			if ( !unpackDir.add(e) ) {
+				std::cerr << "invalid pattern: " << e << std::endl;
+				return 1;
+			}
+		}
+
+		unpack.compile();
+		unpackDir.compile();
 
-		std::string out = argv[3 + shift];
+		std::string out = argv[1 + shift + positional];
 
 		if ( out.size() < 5 || strcmp(out.c_str() + out.size()-5, ".asar") != 0 )
 			out += ".asar";
 
-		if ( !archive.pack( argv[2 + shift], out, unpack, unpackDir, excludeHidden ) )
+		if ( stats || !sTrace.empty() )
+			archive.setTrace( !sTrace.empty() );
+
+		bool ok = sFromTar.empty()
+			? archive.pack( argv[2 + shift], out, &unpack, &unpackDir, excludeHidden )
+			: archive.packFromTar( sFromTar, out, &unpack, &unpackDir, excludeHidden );
+
+		if ( !sTrace.empty() && !archive.writeTrace( sTrace ) )
+			return 1;
+		if ( !ok )
 			return 1;
+		if ( stats )
+			archive.printStats( std::cerr );
 	}
 
 	// list
 	else if ( strcmp(argv[1], "l") == 0 || strcmp(argv[1], "list") == 0 ) {
-		if (argc != 3)
+		int shift = 0;
+
+		for (int i = 2; i < argc - 1; i++) {
+			if ( !parseIndex( argv[i], archive ) )
+				return printHelp(argv[0]);
+			shift++;
+		}
+
+		if ( argc != 3 + shift )
 			return printHelp(argv[0]);
-		if ( !archive.list( argv[2] ) )
+		if ( !archive.list( argv[2 + shift] ) )
 			return 1;
 	}
 
 	// extract all files
 	else if ( strcmp(argv[1], "e") == 0 || strcmp(argv[1], "extract") == 0 ) {
-		if (argc != 4)
+		int shift = 0;
+		bool stats = false;
+		bool bRegex = false;
+		std::string sTrace, sToTar;
+		std::vector<std::string> vInclude, vExclude, vSubtrees;
+
+		if ( argc < 4 )
+			return printHelp(argv[0]);
+
+		for (int i = 2; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+			if ( strncmp(argv[i], "--jobs=", 7) == 0 && strlen(argv[i]) > 7 ) {
+				if ( !parseJobs( argv[i] + 7, archive ) )
+					return printHelp(argv[0]);
+				shift++;
+			} else if ( strcmp(argv[i], "--stats") == 0 ) {
+				stats = true;
+				shift++;
+			} else if ( strncmp(argv[i], "--trace=", 8) == 0 && strlen(argv[i]) > 8 ) {
+				sTrace = argv[i] + 8;
+				shift++;
+			} else if ( strcmp(argv[i], "--io-uring") == 0 ) {
+				archive.setUring( true );
+				shift++;
+			} else if ( strcmp(argv[i], "--no-cache-pollution") == 0 ) {
+				archive.setNoCachePollution( true );
+				shift++;
+			} else if ( strncmp(argv[i], "--include=", 10) == 0 && strlen(argv[i]) > 10 ) {
+				vInclude.push_back( argv[i] + 10 );
+				shift++;
+			} else if ( strncmp(argv[i], "--exclude=", 10) == 0 && strlen(argv[i]) > 10 ) {
+				vExclude.push_back( argv[i] + 10 );
+				shift++;
+			} else if ( strcmp(argv[i], "--regex") == 0 ) {
+				bRegex = true;
+				shift++;
+			} else if ( strncmp(argv[i], "--to-tar=", 9) == 0 && strlen(argv[i]) > 9 ) {
+				sToTar = argv[i] + 9;
+				shift++;
+			} else
+				return printHelp(argv[0]);
+		}
+
+		// no <dest> with --to-tar
+		int positional = sToTar.empty() ? 2 : 1;
+
+		if ( argc < 2 + shift + positional )
 			return printHelp(argv[0]);
-		if ( !archive.unpack( argv[2], argv[3] ) )
+
+		for (int i = 2 + shift + positional; i < argc; i++)
+			vSubtrees.push_back( argv[i] );
+
+		// like --unpack, globs without a '/' match the basename
+		pathMatcher include( bRegex, true );
+		pathMatcher exclude( bRegex, true );
+
+		for ( const auto &e : vInclude ) {
+			if ( bRegex && !regex_check(e.c_str()) )
+				return 1;
+			if ( !include.add(e) ) {
+				std::cerr << "invalid pattern: " << e << std::endl;
+				return 1;
+			}
+		}
+
+		for ( const auto &e : vExclude ) {
+			if ( bRegex && !regex_check(e.c_str()) )
+				return 1;
+			if ( !exclude.add(e) ) {
+				std::cerr << "invalid pattern: " << e << std::endl;
+				return 1;
+			}
+		}
+
+		include.compile();
+		exclude.compile();
+		archive.setSelection( &include, &exclude, vSubtrees );
+
+		if ( stats || !sTrace.empty() )
+			archive.setTrace( !sTrace.empty() );
+
+		bool ok = sToTar.empty()
+			? archive.unpack( argv[2 + shift], argv[3 + shift] )
+			: archive.unpackToTar( argv[2 + shift], sToTar );
+
+		if ( !sTrace.empty() && !archive.writeTrace( sTrace ) )
+			return 1;
+		if ( !ok )
 			return 1;
+		if ( stats )
+			archive.printStats( std::cerr );
 	}
 
-	// extract single file
+	// extract single files
 	else if ( strcmp(argv[1], "ef") == 0 || strcmp(argv[1], "extract-file") == 0 ) {
-		if (argc != 4)
+		int shift = 0;
+		std::vector<std::string> vFiles;
+
+		for (int i = 2; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+			if ( strncmp(argv[i], "--files-from=", 13) == 0 && strlen(argv[i]) > 13 ) {
+				if ( !readFileList( argv[i] + 13, vFiles ) )
+					return 1;
+				shift++;
+			} else if ( parseIndex( argv[i], archive ) ) {
+				shift++;
+			} else
+				return printHelp(argv[0]);
+		}
+
+		if ( argc < 3 + shift || (argc == 3 + shift && vFiles.empty()) )
+			return printHelp(argv[0]);
+
+		for (int i = 3 + shift; i < argc; i++)
+			vFiles.push_back( argv[i] );
+
+		if ( !archive.extractFiles( argv[2 + shift], vFiles ) )
+			return 1;
+	}
+
+	// check integrity hashes
+	else if ( strcmp(argv[1], "v") == 0 || strcmp(argv[1], "verify") == 0 ) {
+		int shift = 0;
+
+		for (int i = 2; i < argc - 1; i++) {
+			if ( strncmp(argv[i], "--jobs=", 7) == 0 && strlen(argv[i]) > 7 ) {
+				if ( !parseJobs( argv[i] + 7, archive ) )
+					return printHelp(argv[0]);
+				shift++;
+			} else
+				return printHelp(argv[0]);
+		}
+
+		if ( argc != 3 + shift )
+			return printHelp(argv[0]);
+		if ( !archive.verify( argv[2 + shift] ) )
+			return 1;
+	}
+
+	// access order from a system call log
+	else if ( strcmp(argv[1], "pr") == 0 || strcmp(argv[1], "profile") == 0 ) {
+		if ( argc != 5 )
 			return printHelp(argv[0]);
-		if ( !archive.unpack( argv[2], "", argv[3] ) )
+		if ( !archive.profile( argv[2], argv[3], argv[4] ) )
 			return 1;
 	}
 
@@ -0,0 +1,514 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include "pathmatcher.h"
+
+// give up on the DFA and simulate the NFA if it gets bigger than this
+#define MAX_DFA_STATES 4096
+
+// limit for the number of patterns a single glob expands to
+#define MAX_BRACE_EXPANSIONS 4096
+
+
+static inline void setAdd( uint64_t *set, int c ) {
+	set[c >> 6] |= uint64_t(1) << (c & 63);
+}
+
+static inline void setDel( uint64_t *set, int c ) {
+	set[c >> 6] &= ~(uint64_t(1) << (c & 63));
+}
+
+static inline bool setHas( const uint64_t *set, int c ) {
+	return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+// all bytes except '/'
+static void setNoSlash( uint64_t *set ) {
+	memset( set, 0xff, 4 * sizeof(uint64_t) );
+	setDel( set, '/' );
+}
+
+pathMatcher::pathMatcher( bool bRegex, bool bMatchBase ) :
+	m_bRegex(bRegex),
+	m_bMatchBase(bMatchBase)
+{
+	memset( m_classOf, 0, sizeof(m_classOf) );
+}
+
+bool pathMatcher::add( const std::string &sPattern ) {
+	if ( m_bRegex ) {
+		try {
+			m_vRegex.push_back( std::regex(sPattern) );
+		}
+		catch (const std::regex_error &) {
+			return false;
+		}
+		return true;
+	}
+
+	std::vector<std::string> vExpanded;
+	expandBraces( sPattern, vExpanded );
+
+	if ( vExpanded.size() > MAX_BRACE_EXPANSIONS )
+		return false;
+
+	m_vGlobs.insert( m_vGlobs.end(), vExpanded.begin(), vExpanded.end() );
+	return true;
+}
+
+// "a{b,c{d,e}}f" -> "abf", "acdf", "acef"
+void pathMatcher::expandBraces( const std::string &s, std::vector<std::string> &vOut ) {
+	for ( size_t i = 0; i < s.size() && vOut.size() <= MAX_BRACE_EXPANSIONS; i++ ) {
+		if ( s[i] == '\\' ) {
+			i++;
+			continue;
+		}
+		if ( s[i] != '{' )
+			continue;
+
+		// find the matching '}' and the commas on this level
+		std::vector<size_t> vCommas;
+		int depth = 0;
+		size_t j;
+
+		for ( j = i + 1; j < s.size(); j++ ) {
+			if ( s[j] == '\\' )
+				j++;
+			else if ( s[j] == '{' )
+				depth++;
+			else if ( s[j] == '}' && depth-- == 0 )
+				break;
+			else if ( s[j] == ',' && depth == 0 )
+				vCommas.push_back(j);
+		}
+
+		// no alternatives, the braces are literal
+		if ( j >= s.size() || vCommas.empty() )
+			continue;
+
+		vCommas.push_back(j);
+		size_t begin = i + 1;
+
+		for ( size_t c : vCommas ) {
+			expandBraces( s.substr(0, i) + s.substr(begin, c - begin) + s.substr(j + 1), vOut );
+			begin = c + 1;
+		}
+		return;
+	}
+
+	vOut.push_back(s);
+}
+
+uint32_t pathMatcher::newState() {
+	m_vNfa.push_back( nfaState_t() );
+	m_vNfa.back().bAccept = false;
+	return m_vNfa.size() - 1;
+}
+
+void pathMatcher::addEdge( uint32_t from, uint32_t to, const uint64_t *set ) {
+	edge_t e;
+	e.to = to;
+	e.bEpsilon = false;
+	memcpy( e.set, set, sizeof(e.set) );
+	m_vNfa[from].edges.push_back(e);
+}
+
+void pathMatcher::addEpsilon( uint32_t from, uint32_t to ) {
+	edge_t e;
+	e.to = to;
+	e.bEpsilon = true;
+	memset( e.set, 0, sizeof(e.set) );
+	m_vNfa[from].edges.push_back(e);
+}
+
+// Add the NFA for one (brace expanded) glob, starting at state start
+bool pathMatcher::compileGlob( const std::string &sGlob, uint32_t start ) {
+	std::string s = sGlob;
+
+	while ( s.compare(0, 2, "./") == 0 )
+		s.erase(0, 2);
+	while ( !s.empty() && s[0] == '/' )
+		s.erase(0, 1);
+
+	// split into path segments
+	std::vector<std::string> vSegs;
+	size_t pos = 0;
+
+	while ( pos <= s.size() ) {
+		size_t end = s.find('/', pos);
+		if ( end == std::string::npos )
+			end = s.size();
+		if ( end > pos )
+			vSegs.push_back( s.substr(pos, end - pos) );
+		pos = end + 1;
+	}
+
+	if ( vSegs.empty() )
+		return false;
+
+	uint64_t any[4], noSlash[4], one[4];
+	memset( any, 0xff, sizeof(any) );
+	setNoSlash( noSlash );
+
+	uint32_t cur = start;
+
+	if ( m_bMatchBase && vSegs.size() == 1 ) {
+		// match the basename: skip anything up to the last '/'
+		uint32_t dirs = newState();
+		uint32_t base = newState();
+		memset( one, 0, sizeof(one) );
+		setAdd( one, '/' );
+
+		addEpsilon( cur, base );
+		addEdge( cur, dirs, any );
+		addEdge( dirs, dirs, any );
+		addEdge( dirs, base, one );
+		cur = base;
+	}
+
+	uint32_t beforeSlash = cur;
+
+	for ( size_t k = 0; k < vSegs.size(); k++ ) {
+		const std::string &seg = vSegs[k];
+		const bool bLast = (k + 1 == vSegs.size());
+		const uint32_t segStart = cur;
+
+		if ( seg == "**" ) {
+			// any number of whole segments, none starting with '.'
+			uint32_t in = newState();
+			memcpy( one, noSlash, sizeof(one) );
+			setDel( one, '.' );
+			addEdge( cur, in, one );
+			addEdge( in, in, noSlash );
+			memset( one, 0, sizeof(one) );
+			setAdd( one, '/' );
+			addEdge( in, cur, one );
+
+			if ( bLast ) {
+				m_vNfa[in].bAccept = true;
+				if ( k > 0 )
+					m_vNfa[beforeSlash].bAccept = true;  // "a/**" matches "a"
+			}
+		} else {
+			// The segment is built starting at an unreachable state, its
+			// first byte is then consumed by copies of the first edges on
+			// segStart. That way the empty segment doesn't match and
+			// wildcards can be kept from matching a leading '.', unless
+			// the pattern has a literal one there.
+			cur = newState();
+			const uint32_t segIn = cur;
+
+			for ( size_t i = 0; i < seg.size(); i++ ) {
+				char c = seg[i];
+				uint32_t next;
+
+				if ( c == '*' ) {
+					while ( i + 1 < seg.size() && seg[i + 1] == '*' )
+						i++;
+
+					uint32_t loop = newState();
+					next = newState();
+					addEdge( cur, loop, noSlash );
+					addEdge( loop, loop, noSlash );
+					addEpsilon( cur, next );
+					addEpsilon( loop, next );
+					cur = next;
+					continue;
+				}
+
+				memset( one, 0, sizeof(one) );
+
+				if ( c == '?' ) {
+					setNoSlash( one );
+				} else if ( c == '[' && seg.find(']', i + 2) != std::string::npos ) {
+					size_t j = i + 1;
+					bool bNegate = false;
+
+					if ( seg[j] == '!' || seg[j] == '^' ) {
+						bNegate = true;
+						j++;
+					}
+
+					// a ']' right after the '[' is part of the class
+					for ( bool bFirst = true; j < seg.size() && (bFirst || seg[j] != ']'); bFirst = false ) {
+						unsigned char lo = seg[j];
+						if ( lo == '\\' && j + 1 < seg.size() )
+							lo = seg[++j];
+						unsigned char hi = lo;
+						j++;
+
+						if ( j + 1 < seg.size() && seg[j] == '-' && seg[j + 1] != ']' ) {
+							hi = seg[j + 1];
+							if ( hi == '\\' && j + 2 < seg.size() ) {
+								hi = seg[j + 2];
+								j++;
+							}
+							j += 2;
+						}
+
+						for ( int b = lo; b <= hi; b++ )
+							setAdd( one, b );
+					}
+
+					if ( j >= seg.size() ) {
+						// no closing ']', treat the '[' literally
+						memset( one, 0, sizeof(one) );
+						setAdd( one, '[' );
+					} else {
+						if ( bNegate ) {
+							for ( int w = 0; w < 4; w++ )
+								one[w] = ~one[w];
+						}
+						setDel( one, '/' );
+						i = j;
+					}
+				} else {
+					if ( c == '\\' && i + 1 < seg.size() )
+						c = seg[++i];
+					setAdd( one, static_cast<unsigned char>(c) );
+				}
+
+				next = newState();
+				addEdge( cur, next, one );
+				cur = next;
+			}
+
+			if ( bLast )
+				m_vNfa[cur].bAccept = true;
+
+			const bool bLiteralDot = seg[0] == '.' || (seg[0] == '\\' && seg.size() > 1 && seg[1] == '.');
+			std::vector<uint32_t> vFirst(1, segIn);
+			closure( vFirst );
+
+			for ( uint32_t st : vFirst ) {
+				for ( size_t n = 0; n < m_vNfa[st].edges.size(); n++ ) {
+					edge_t e = m_vNfa[st].edges[n];
+					if ( e.bEpsilon )
+						continue;
+					setDel( e.set, '/' );
+					if ( !bLiteralDot )
+						setDel( e.set, '.' );
+					addEdge( segStart, e.to, e.set );
+				}
+			}
+		}
+
+		if ( !bLast && seg != "**" ) {
+			uint32_t next = newState();
+			memset( one, 0, sizeof(one) );
+			setAdd( one, '/' );
+			addEdge( cur, next, one );
+			beforeSlash = cur;
+			cur = next;
+		}
+	}
+
+	return true;
+}
+
+// extend vStates by everything reachable through epsilon moves
+void pathMatcher::closure( std::vector<uint32_t> &vStates ) const {
+	for ( size_t i = 0; i < vStates.size(); i++ ) {
+		for ( const auto &e : m_vNfa[vStates[i]].edges ) {
+			if ( e.bEpsilon && std::find(vStates.begin(), vStates.end(), e.to) == vStates.end() )
+				vStates.push_back( e.to );
+		}
+	}
+	std::sort( vStates.begin(), vStates.end() );
+}
+
+void pathMatcher::step( const std::vector<uint32_t> &vFrom, int c, std::vector<uint32_t> &vTo ) const {
+	vTo.clear();
+
+	for ( uint32_t st : vFrom ) {
+		for ( const auto &e : m_vNfa[st].edges ) {
+			if ( !e.bEpsilon && setHas(e.set, c) && std::find(vTo.begin(), vTo.end(), e.to) == vTo.end() )
+				vTo.push_back( e.to );
+		}
+	}
+
+	closure( vTo );
+}
+
+bool pathMatcher::isAccepting( const std::vector<uint32_t> &vStates ) const {
+	for ( uint32_t st : vStates ) {
+		if ( m_vNfa[st].bAccept )
+			return true;
+	}
+	return false;
+}
+
+void pathMatcher::compile() {
+	m_vNfa.clear();
+	m_vTable.clear();
+	m_vAccept.clear();
+	m_bDfa = false;
+
+	if ( m_bRegex || m_vGlobs.empty() )
+		return;
+
+	// state 0 branches into all patterns
+	const uint32_t root = newState();
+
+	for ( const auto &g : m_vGlobs ) {
+		uint32_t start = newState();
+		if ( compileGlob(g, start) )
+			addEpsilon( root, start );
+	}
+
+	// bytes that no edge tells apart share a class
+	std::map<std::vector<bool>, uint8_t> mapClasses;
+	std::vector<bool> sig;
+
+	for ( int c = 0; c < 256; c++ ) {
+		sig.clear();
+		for ( const auto &st : m_vNfa ) {
+			for ( const auto &e : st.edges ) {
+				if ( !e.bEpsilon )
+					sig.push_back( setHas(e.set, c) );
+			}
+		}
+
+		auto it = mapClasses.find(sig);
+		if ( it == mapClasses.end() )
+			it = mapClasses.insert( std::make_pair(sig, static_cast<uint8_t>(mapClasses.size())) ).first;
+		m_classOf[c] = it->second;
+	}
+
+	m_numClasses = mapClasses.size();
+
+	std::vector<int> vRepresentative( m_numClasses, -1 );
+	for ( int c = 255; c >= 0; c-- )
+		vRepresentative[ m_classOf[c] ] = c;
+
+	// subset construction, DFA state 0 is the dead state
+	std::map<std::vector<uint32_t>, uint32_t> mapStates;
+	std::vector<std::vector<uint32_t>> vSets;
+
+	vSets.push_back( std::vector<uint32_t>() );
+	mapStates[ vSets[0] ] = 0;
+	m_vAccept.push_back( false );
+
+	std::vector<uint32_t> vStart(1, root);
+	closure( vStart );
+	mapStates[vStart] = 1;
+	vSets.push_back( vStart );
+	m_vAccept.push_back( isAccepting(vStart) );
+	m_start = 1;
+
+	m_vTable.assign( 2 * m_numClasses, 0 );
+	std::vector<uint32_t> vNext;
+
+	for ( size_t d = 1; d < vSets.size(); d++ ) {
+		for ( uint32_t k = 0; k < m_numClasses; k++ ) {
+			step( vSets[d], vRepresentative[k], vNext );
+
+			auto it = mapStates.find(vNext);
+			if ( it == mapStates.end() ) {
+				if ( vSets.size() >= MAX_DFA_STATES ) {
+					m_vTable.clear();
+					m_vAccept.clear();
+					return;
+				}
+
+				it = mapStates.insert( std::make_pair(vNext, static_cast<uint32_t>(vSets.size())) ).first;
+				vSets.push_back( vNext );
+				m_vAccept.push_back( isAccepting(vNext) );
+				m_vTable.resize( vSets.size() * m_numClasses, 0 );
+			}
+
+			m_vTable[d * m_numClasses + k] = it->second;
+		}
+	}
+
+	m_bDfa = true;
+}
+
+bool pathMatcher::match( const char *path, size_t len ) const {
+	if ( m_bRegex ) {
+		for ( const auto &re : m_vRegex ) {
+			if ( std::regex_match(path, path + len, re) )
+				return true;
+		}
+		return false;
+	}
+
+	if ( m_vNfa.empty() )
+		return false;
+
+	if ( m_bDfa ) {
+		const uint32_t *table = m_vTable.data();
+		uint32_t st = m_start;
+
+		for ( size_t i = 0; i < len && st != 0; i++ )
+			st = table[st * m_numClasses + m_classOf[static_cast<unsigned char>(path[i])]];
+
+		return m_vAccept[st];
+	}
+
+	std::vector<uint32_t> vCur(1, 0), vNext;
+	closure( vCur );
+
+	for ( size_t i = 0; i < len && !vCur.empty(); i++ ) {
+		step( vCur, static_cast<unsigned char>(path[i]), vNext );
+		vCur.swap( vNext );
+	}
+
+	return isAccepting( vCur );
+}
+
+bool pathMatcher::matchBelow( const char *dir, size_t len ) const {
+	if ( m_bRegex )
+		return true;
+
+	if ( m_vNfa.empty() )
+		return false;
+
+	// run dir and a '/', no match below if that ends in the dead state
+	if ( m_bDfa ) {
+		const uint32_t *table = m_vTable.data();
+		uint32_t st = m_start;
+
+		for ( size_t i = 0; i < len && st != 0; i++ )
+			st = table[st * m_numClasses + m_classOf[static_cast<unsigned char>(dir[i])]];
+		if ( st != 0 )
+			st = table[st * m_numClasses + m_classOf['/']];
+
+		return st != 0;
+	}
+
+	std::vector<uint32_t> vCur(1, 0), vNext;
+	closure( vCur );
+
+	for ( size_t i = 0; i <= len && !vCur.empty(); i++ ) {
+		step( vCur, (i < len) ? static_cast<unsigned char>(dir[i]) : '/', vNext );
+		vCur.swap( vNext );
+	}
+
+	return !vCur.empty();
+}
@@ -0,0 +1,108 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PATHMATCHER_H_INCLUDED
+#define PATHMATCHER_H_INCLUDED
+
+#include <regex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+// Matches paths against a set of patterns, either minimatch style globs
+// or ECMAScript regular expressions. Globs are compiled into a single
+// DFA, so matching a path is one table lookup per byte. After compile()
+// the matcher is read-only and can be shared between threads.
+//
+// Glob syntax: '*' and '?' (not matching '/'), '[...]' classes with
+// '!' or '^' negation, '{a,b}' alternatives, '\' escapes and "**" as a
+// whole path segment matching any number of directories. Wildcards
+// don't match a leading '.' of a path segment. With matchBase set, a
+// glob without a '/' is matched against the basename.
+class pathMatcher {
+
+public:
+	explicit pathMatcher( bool bRegex = false, bool bMatchBase = false );
+
+	// add a pattern, returns false if it is invalid
+	bool add( const std::string &sPattern );
+
+	// build the DFA, call once after all patterns were added
+	void compile();
+
+	bool match( const char *path, size_t len ) const;
+	bool match( const std::string &sPath ) const { return match( sPath.data(), sPath.size() ); }
+
+	// false if no path below directory dir can match, so it can be
+	// skipped as a whole; always true for regular expressions
+	bool matchBelow( const char *dir, size_t len ) const;
+	bool matchBelow( const std::string &sDir ) const { return matchBelow( sDir.data(), sDir.size() ); }
+
+	bool empty() const { return m_vGlobs.empty() && m_vRegex.empty(); }
+	bool isRegex() const { return m_bRegex; }
+
+private:
+	// NFA built from the globs, a transition either consumes
+	// one byte of a set or is an epsilon move (bEpsilon)
+	typedef struct {
+		uint32_t to;
+		bool bEpsilon;
+		uint64_t set[4];  // 256 bit byte set
+	} edge_t;
+
+	typedef struct {
+		std::vector<edge_t> edges;
+		bool bAccept;
+	} nfaState_t;
+
+	bool m_bRegex;
+	bool m_bMatchBase;
+	std::vector<std::string> m_vGlobs;
+	std::vector<std::regex> m_vRegex;
+
+	std::vector<nfaState_t> m_vNfa;
+
+	// DFA: m_vTable[state * m_numClasses + m_classOf[byte]], state 0 is dead
+	uint8_t m_classOf[256];
+	uint32_t m_numClasses = 0;
+	std::vector<uint32_t> m_vTable;
+	std::vector<bool> m_vAccept;
+	uint32_t m_start = 0;
+	bool m_bDfa = false;  // false if the DFA got too big, the NFA is simulated then
+
+	uint32_t newState();
+	void addEdge( uint32_t from, uint32_t to, const uint64_t *set );
+	void addEpsilon( uint32_t from, uint32_t to );
+	bool compileGlob( const std::string &sGlob, uint32_t start );
+	void closure( std::vector<uint32_t> &vStates ) const;
+	void step( const std::vector<uint32_t> &vFrom, int c, std::vector<uint32_t> &vTo ) const;
+	bool isAccepting( const std::vector<uint32_t> &vStates ) const;
+
+	static void expandBraces( const std::string &s, std::vector<std::string> &vOut );
+
+};
+
+#endif // PATHMATCHER_H_INCLUDED
@@ -0,0 +1,249 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "sha256.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_SHA_NI
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t ror( uint32_t x, int n ) {
+	return (x >> n) | (x << (32 - n));
+}
+
+static void compressGeneric( uint32_t *state, const uint8_t *data, size_t blocks ) {
+	uint32_t w[64];
+
+	for ( ; blocks > 0; blocks--, data += 64 ) {
+		for ( int i = 0; i < 16; i++ ) {
+			w[i] = (uint32_t(data[4*i]) << 24) | (uint32_t(data[4*i + 1]) << 16) |
+				(uint32_t(data[4*i + 2]) << 8) | uint32_t(data[4*i + 3]);
+		}
+
+		for ( int i = 16; i < 64; i++ ) {
+			uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for ( int i = 0; i < 64; i++ ) {
+			uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+			uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+#ifdef HAVE_SHA_NI
+// message schedule for rounds 4*i .. 4*i+3, m[] holds the
+// words of the previous 16 rounds
+#define SCHEDULE(i) \
+	m[(i) & 3] = _mm_sha256msg2_epu32( _mm_add_epi32( \
+		_mm_sha256msg1_epu32(m[(i) & 3], m[((i) + 1) & 3]), \
+		_mm_alignr_epi8(m[((i) + 3) & 3], m[((i) + 2) & 3], 4) ), m[((i) + 3) & 3] )
+
+#define ROUNDS(i) \
+	msg = _mm_add_epi32( m[(i) & 3], _mm_loadu_si128(reinterpret_cast<const __m128i *>(K + 4*(i))) ); \
+	state1 = _mm_sha256rnds2_epu32( state1, state0, msg ); \
+	state0 = _mm_sha256rnds2_epu32( state0, state1, _mm_shuffle_epi32(msg, 0x0e) )
+
+__attribute__((target("sha,sse4.1")))
+static void compressShaNi( uint32_t *state, const uint8_t *data, size_t blocks ) {
+	const __m128i bswap = _mm_set_epi64x( 0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL );
+	__m128i m[4], msg;
+
+	// the instructions want the state as ABEF and CDGH
+	__m128i tmp = _mm_shuffle_epi32( _mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0xb1 );
+	__m128i state1 = _mm_shuffle_epi32( _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4)), 0x1b );
+	__m128i state0 = _mm_alignr_epi8( tmp, state1, 8 );
+	state1 = _mm_blend_epi16( state1, tmp, 0xf0 );
+
+	for ( ; blocks > 0; blocks--, data += 64 ) {
+		const __m128i save0 = state0;
+		const __m128i save1 = state1;
+
+		for ( int i = 0; i < 4; i++ )
+			m[i] = _mm_shuffle_epi8( _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16*i)), bswap );
+
+		ROUNDS(0); ROUNDS(1); ROUNDS(2); ROUNDS(3);
+		SCHEDULE(4); ROUNDS(4); SCHEDULE(5); ROUNDS(5);
+		SCHEDULE(6); ROUNDS(6); SCHEDULE(7); ROUNDS(7);
+		SCHEDULE(8); ROUNDS(8); SCHEDULE(9); ROUNDS(9);
+		SCHEDULE(10); ROUNDS(10); SCHEDULE(11); ROUNDS(11);
+		SCHEDULE(12); ROUNDS(12); SCHEDULE(13); ROUNDS(13);
+		SCHEDULE(14); ROUNDS(14); SCHEDULE(15); ROUNDS(15);
+
+		state0 = _mm_add_epi32( state0, save0 );
+		state1 = _mm_add_epi32( state1, save1 );
+	}
+
+	// back to ABCD and EFGH
+	tmp = _mm_shuffle_epi32( state0, 0x1b );
+	state1 = _mm_shuffle_epi32( state1, 0xb1 );
+	state0 = _mm_blend_epi16( tmp, state1, 0xf0 );
+	state1 = _mm_alignr_epi8( state1, tmp, 8 );
+
+	_mm_storeu_si128( reinterpret_cast<__m128i *>(state), state0 );
+	_mm_storeu_si128( reinterpret_cast<__m128i *>(state + 4), state1 );
+}
+
+#undef SCHEDULE
+#undef ROUNDS
+
+static bool haveShaNi() {
+	unsigned int a, b, c, d;
+
+	// SSSE3 and SSE4.1 for the shuffles and blends
+	if ( !__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) || !(c & bit_SSE4_1) )
+		return false;
+
+	return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 29));
+}
+#endif // HAVE_SHA_NI
+
+sha256::compress_t sha256::compressFunction() {
+#ifdef HAVE_SHA_NI
+	static const compress_t f = haveShaNi() ? compressShaNi : compressGeneric;
+	return f;
+#else
+	return compressGeneric;
+#endif
+}
+
+const char *sha256::implementation() {
+	return (compressFunction() == compressGeneric) ? "generic" : "sha-ni";
+}
+
+void sha256::reset() {
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy( m_state, init, sizeof(m_state) );
+	m_length = 0;
+	m_bufLen = 0;
+}
+
+void sha256::update( const void *data, size_t len ) {
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	compress_t compress = compressFunction();
+
+	m_length += len;
+
+	if ( m_bufLen > 0 ) {
+		size_t n = std::min<size_t>( len, 64 - m_bufLen );
+		memcpy( m_buf + m_bufLen, p, n );
+		m_bufLen += n;
+		p += n;
+		len -= n;
+
+		if ( m_bufLen < 64 )
+			return;
+
+		compress( m_state, m_buf, 1 );
+		m_bufLen = 0;
+	}
+
+	// whole blocks straight from the input
+	if ( len >= 64 ) {
+		compress( m_state, p, len / 64 );
+		p += len & ~size_t(63);
+		len &= 63;
+	}
+
+	memcpy( m_buf, p, len );
+	m_bufLen = len;
+}
+
+void sha256::final( uint8_t digest[32] ) {
+	uint64_t bits = m_length * 8;
+	compress_t compress = compressFunction();
+
+	m_buf[m_bufLen++] = 0x80;
+
+	if ( m_bufLen > 56 ) {
+		memset( m_buf + m_bufLen, 0, 64 - m_bufLen );
+		compress( m_state, m_buf, 1 );
+		m_bufLen = 0;
+	}
+
+	memset( m_buf + m_bufLen, 0, 56 - m_bufLen );
+	for ( int i = 0; i < 8; i++ )
+		m_buf[56 + i] = uint8_t( bits >> (56 - 8*i) );
+	compress( m_state, m_buf, 1 );
+
+	for ( int i = 0; i < 8; i++ ) {
+		digest[4*i] = uint8_t( m_state[i] >> 24 );
+		digest[4*i + 1] = uint8_t( m_state[i] >> 16 );
+		digest[4*i + 2] = uint8_t( m_state[i] >> 8 );
+		digest[4*i + 3] = uint8_t( m_state[i] );
+	}
+
+	reset();
+}
+
+void sha256::hash( const void *data, size_t len, uint8_t digest[32] ) {
+	sha256 ctx;
+	ctx.update( data, len );
+	ctx.final( digest );
+}
+
+void sha256::toHex( const uint8_t digest[32], char *out ) {
+	static const char hex[] = "0123456789abcdef";
+
+	for ( int i = 0; i < 32; i++ ) {
+		out[2*i] = hex[digest[i] >> 4];
+		out[2*i + 1] = hex[digest[i] & 15];
+	}
+}
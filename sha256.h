@@ -0,0 +1,66 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SHA256_H_INCLUDED
+#define SHA256_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// SHA-256 for the integrity hashes of an archive. The compression
+// function is picked at runtime: the SHA extensions (SHA-NI) on x86
+// CPUs that have them, portable C++ everywhere else.
+class sha256 {
+
+public:
+	sha256() { reset(); }
+
+	void reset();
+	void update( const void *data, size_t len );
+	void final( uint8_t digest[32] );
+
+	// one-shot hash
+	static void hash( const void *data, size_t len, uint8_t digest[32] );
+
+	// 64 lowercase hex digits, not NUL-terminated
+	static void toHex( const uint8_t digest[32], char *out );
+
+	// name of the compression function in use, "sha-ni" or "generic"
+	static const char *implementation();
+
+private:
+	typedef void (*compress_t)( uint32_t *state, const uint8_t *data, size_t blocks );
+
+	uint32_t m_state[8];
+	uint64_t m_length;  // bytes hashed so far
+	uint8_t m_buf[64];
+	size_t m_bufLen;
+
+	static compress_t compressFunction();
+
+};
+
+#endif // SHA256_H_INCLUDED
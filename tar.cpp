@@ -0,0 +1,464 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "tar.h"
+
+// read from the stream in chunks of this size
+#define TAR_READ_BUFFER (512*1024)
+
+// longest pax or GNU long name record that is read
+#define TAR_MAX_EXTENDED (16*1024*1024)
+
+// biggest number of an octal field of n bytes
+#define TAR_OCTAL_MAX(n) ((uint64_t(1) << (3 * ((n) - 1))) - 1)
+
+
+// ustar header block, numbers are octal and NUL-terminated
+typedef struct {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];     // "ustar\0", GNU tar writes "ustar " and has no prefix
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];  // directories of name if it doesn't fit
+	char pad[12];
+} ustarHeader_t;
+
+static void setOctal( char *p, size_t len, uint64_t v ) {
+	p[--len] = 0;
+	while ( len > 0 ) {
+		p[--len] = '0' + (v & 7);
+		v >>= 3;
+	}
+}
+
+static void setString( char *p, size_t len, const std::string &s ) {
+	memcpy( p, s.data(), std::min(len, s.size()) );
+}
+
+static unsigned checksum( const ustarHeader_t &h, bool bSigned ) {
+	const char *p = reinterpret_cast<const char *>( &h );
+	unsigned sum = 8 * ' ';  // the field itself counts as spaces
+
+	for ( size_t i = 0; i < TAR_BLOCK; i++ ) {
+		if ( p + i < h.chksum || p + i >= h.chksum + sizeof(h.chksum) )
+			sum += bSigned ? static_cast<unsigned>( static_cast<signed char>(p[i]) ) : static_cast<unsigned char>(p[i]);
+	}
+
+	return sum;
+}
+
+static void headerBlock( std::string &s, const std::string &sName, const std::string &sPrefix, char typeflag,
+	unsigned mode, uint64_t size, int64_t mtime, const std::string &sLink )
+{
+	ustarHeader_t h;
+	memset( &h, 0, sizeof(h) );
+
+	setString( h.name, sizeof(h.name), sName );
+	setOctal( h.mode, sizeof(h.mode), mode );
+	setOctal( h.uid, sizeof(h.uid), 0 );
+	setOctal( h.gid, sizeof(h.gid), 0 );
+	setOctal( h.size, sizeof(h.size), size <= TAR_OCTAL_MAX(sizeof(h.size)) ? size : 0 );
+	setOctal( h.mtime, sizeof(h.mtime), mtime > 0 ? mtime : 0 );
+	h.typeflag = typeflag;
+	setString( h.linkname, sizeof(h.linkname), sLink );
+	memcpy( h.magic, "ustar", 6 );
+	memcpy( h.version, "00", 2 );
+	setString( h.prefix, sizeof(h.prefix), sPrefix );
+
+	// six digits, NUL and space
+	setOctal( h.chksum, 7, checksum(h, false) );
+	h.chksum[7] = ' ';
+
+	s.append( reinterpret_cast<const char *>(&h), TAR_BLOCK );
+}
+
+// "<length> <key>=<value>\n", the length counts its own digits
+static void paxRecord( std::string &s, const char *key, const std::string &sValue ) {
+	size_t n = strlen(key) + sValue.size() + 3;
+	size_t len = n + 1;
+
+	while ( len != n + std::to_string(len).size() )
+		len = n + std::to_string(len).size();
+
+	s += std::to_string(len);
+	s += ' ';
+	s += key;
+	s += '=';
+	s += sValue;
+	s += '\n';
+}
+
+void tarWriter::header( std::string &s, const std::string &sPath, char type, uint64_t size,
+	const std::string &sLink, int64_t mtime )
+{
+	std::string sName( sPath ), sPrefix, sRecords;
+	unsigned mode = 0644;
+	char typeflag = '0';
+
+	if ( type == 'D' ) {
+		sName.push_back( '/' );
+		mode = 0755;
+		typeflag = '5';
+		size = 0;
+	} else if ( type == 'L' ) {
+		mode = 0777;
+		typeflag = '2';
+		size = 0;
+	} else if ( type == 'X' ) {
+		mode = 0755;
+	}
+
+	if ( sName.size() > 100 ) {
+		// split at a '/' into prefix and name, or a pax record
+		size_t pos = sName.find( '/', sName.size() - 101 );
+
+		if ( pos != std::string::npos && pos > 0 && pos <= 155 && pos + 1 < sName.size() && sName[pos + 1] != '/' ) {
+			sPrefix = sName.substr( 0, pos );
+			sName.erase( 0, pos + 1 );
+		} else {
+			paxRecord( sRecords, "path", sName );
+		}
+	}
+
+	if ( sLink.size() > 100 )
+		paxRecord( sRecords, "linkpath", sLink );
+	if ( size > TAR_OCTAL_MAX(12) )
+		paxRecord( sRecords, "size", std::to_string(size) );
+
+	if ( !sRecords.empty() ) {
+		headerBlock( s, "././@PaxHeader", "", 'x', 0644, sRecords.size(), mtime, "" );
+		s += sRecords;
+		s.append( padding(sRecords.size()), 0 );
+	}
+
+	headerBlock( s, sName, sPrefix, typeflag, mode, size, mtime, sLink );
+}
+
+void tarWriter::end( std::string &s ) {
+	s.append( 2 * TAR_BLOCK, 0 );
+}
+
+tarReader::tarReader( int fd ) :
+	m_fd(fd),
+	m_vBuf(TAR_READ_BUFFER)
+{}
+
+bool tarReader::fail( const char *msg ) {
+	m_sError = msg;
+	return false;
+}
+
+// exactly size bytes of the stream, straight into buf if they don't fit the buffer
+bool tarReader::readRaw( char *buf, size_t size ) {
+	while ( size > 0 ) {
+		if ( m_pos == m_len ) {
+			char *dest = ( size >= m_vBuf.size() ) ? buf : m_vBuf.data();
+			size_t want = ( size >= m_vBuf.size() ) ? size : m_vBuf.size();
+			ssize_t n = ::read( m_fd, dest, want );
+
+			if ( n < 0 && errno == EINTR )
+				continue;
+			if ( n < 0 )
+				return fail( strerror(errno) );
+			if ( n == 0 )
+				return fail( "unexpected end of tar stream" );
+
+			if ( dest == buf ) {
+				buf += n;
+				size -= n;
+				continue;
+			}
+
+			m_pos = 0;
+			m_len = n;
+		}
+
+		size_t n = std::min( size, m_len - m_pos );
+		memcpy( buf, m_vBuf.data() + m_pos, n );
+		m_pos += n;
+		buf += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+bool tarReader::skip( uint64_t size ) {
+	while ( size > 0 ) {
+		if ( m_pos == m_len ) {
+			ssize_t n = ::read( m_fd, m_vBuf.data(), m_vBuf.size() );
+
+			if ( n < 0 && errno == EINTR )
+				continue;
+			if ( n < 0 )
+				return fail( strerror(errno) );
+			if ( n == 0 )
+				return fail( "unexpected end of tar stream" );
+
+			m_pos = 0;
+			m_len = n;
+		}
+
+		size_t n = std::min<uint64_t>( size, m_len - m_pos );
+		m_pos += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+bool tarReader::read( char *buf, size_t size ) {
+	if ( size > m_left )
+		return fail( "read past the end of a tar entry" );
+
+	m_left -= size;
+	return readRaw( buf, size );
+}
+
+// the data of a pax header or GNU long name entry
+bool tarReader::longValue( uint64_t size, std::string &s ) {
+	if ( size > TAR_MAX_EXTENDED )
+		return fail( "tar extended header too big" );
+
+	s.resize( size );
+	return ( size == 0 || readRaw( &s[0], size ) ) && skip( tarWriter::padding(size) );
+}
+
+// an octal or, if the first bit is set, base-256 field
+uint64_t tarReader::number( const char *p, size_t len, bool &ok ) {
+	uint64_t v = 0;
+	size_t i = 0;
+
+	if ( len > 0 && (p[0] & 0x80) ) {
+		v = p[0] & 0x3f;
+		for ( i = 1; i < len; i++ ) {
+			if ( v >> 56 )
+				ok = false;
+			v = (v << 8) | static_cast<unsigned char>( p[i] );
+		}
+		return v;
+	}
+
+	while ( i < len && p[i] == ' ' )
+		i++;
+	for ( ; i < len && p[i] >= '0' && p[i] <= '7'; i++ )
+		v = (v << 3) | (p[i] - '0');
+	for ( ; i < len; i++ ) {
+		if ( p[i] != ' ' && p[i] != 0 )
+			ok = false;
+	}
+
+	return v;
+}
+
+// drop empty and "." segments
+std::string tarReader::cleanPath( const std::string &s ) {
+	std::string sOut;
+	size_t pos = 0;
+
+	while ( pos <= s.size() ) {
+		size_t end = s.find( '/', pos );
+		if ( end == std::string::npos )
+			end = s.size();
+
+		if ( end > pos && !(end == pos + 1 && s[pos] == '.') ) {
+			if ( !sOut.empty() )
+				sOut.push_back( '/' );
+			sOut.append( s, pos, end - pos );
+		}
+		pos = end + 1;
+	}
+
+	return sOut;
+}
+
+bool tarReader::next( entry_t &e ) {
+	std::string sPaxPath, sPaxLink, sLongName, sLongLink, sRecords;
+	uint64_t paxSize = 0;
+	bool hasPaxPath = false, hasPaxLink = false, hasPaxSize = false;
+
+	// the rest of the previous entry
+	if ( !skip(m_left) )
+		return false;
+	m_left = 0;
+
+	for (;;) {
+		ustarHeader_t h;
+
+		// end of the stream after an entry, without the zero blocks
+		if ( m_pos == m_len && sRecords.empty() && sLongName.empty() && sLongLink.empty() ) {
+			ssize_t n;
+			while ( (n = ::read( m_fd, m_vBuf.data(), m_vBuf.size() )) < 0 && errno == EINTR )
+				;
+			if ( n < 0 )
+				return fail( strerror(errno) );
+			if ( n == 0 )
+				return false;
+			m_pos = 0;
+			m_len = n;
+		}
+
+		if ( !readRaw( reinterpret_cast<char *>(&h), TAR_BLOCK ) )
+			return false;
+
+		const char *p = reinterpret_cast<const char *>( &h );
+		if ( std::all_of( p, p + TAR_BLOCK, [] (char c) { return c == 0; } ) )
+			return false;
+
+		bool ok = true;
+		unsigned sum = number( h.chksum, sizeof(h.chksum), ok );
+
+		if ( !ok || (sum != checksum(h, false) && sum != checksum(h, true)) )
+			return fail( "invalid tar header checksum" );
+
+		uint64_t size = number( h.size, sizeof(h.size), ok );
+		unsigned mode = number( h.mode, sizeof(h.mode), ok );
+
+		if ( !ok )
+			return fail( "invalid number in tar header" );
+
+		switch ( h.typeflag ) {
+		case 'x':
+			// pax extended header for the next entry
+			if ( !longValue(size, sRecords) )
+				return false;
+
+			for ( size_t pos = 0; pos < sRecords.size(); ) {
+				char *end;
+				unsigned long len = strtoul( sRecords.c_str() + pos, &end, 10 );
+				const char *rec = sRecords.c_str() + pos;
+				const char *space = static_cast<const char *>( memchr(rec, ' ', sRecords.size() - pos) );
+
+				if ( len == 0 || len > sRecords.size() - pos || !space || end != space || rec[len - 1] != '\n' )
+					return fail( "invalid pax header" );
+
+				const char *key = space + 1;
+				const char *eq = static_cast<const char *>( memchr(key, '=', rec + len - key) );
+
+				if ( !eq )
+					return fail( "invalid pax header" );
+
+				std::string sKey( key, eq - key );
+				std::string sValue( eq + 1, rec + len - 1 - (eq + 1) );
+
+				if ( sKey == "path" ) {
+					sPaxPath = sValue;
+					hasPaxPath = true;
+				} else if ( sKey == "linkpath" ) {
+					sPaxLink = sValue;
+					hasPaxLink = true;
+				} else if ( sKey == "size" ) {
+					paxSize = strtoull( sValue.c_str(), &end, 10 );
+					hasPaxSize = ( *end == 0 );
+				}
+
+				pos += len;
+			}
+			continue;
+		case 'g':
+			// global pax header, nothing in it matters here
+			if ( !skip( size + tarWriter::padding(size) ) )
+				return false;
+			continue;
+		case 'L':
+			// GNU long name for the next entry
+			if ( !longValue(size, sLongName) )
+				return false;
+			sLongName.resize( strnlen(sLongName.c_str(), sLongName.size()) );
+			continue;
+		case 'K':
+			// GNU long link target
+			if ( !longValue(size, sLongLink) )
+				return false;
+			sLongLink.resize( strnlen(sLongLink.c_str(), sLongLink.size()) );
+			continue;
+		default:
+			break;
+		}
+
+		std::string sName( h.name, strnlen(h.name, sizeof(h.name)) );
+		std::string sLink( h.linkname, strnlen(h.linkname, sizeof(h.linkname)) );
+
+		if ( memcmp(h.magic, "ustar", 6) == 0 && h.prefix[0] != 0 )
+			sName = std::string( h.prefix, strnlen(h.prefix, sizeof(h.prefix)) ) + '/' + sName;
+		if ( !sLongName.empty() )
+			sName = sLongName;
+		if ( hasPaxPath )
+			sName = sPaxPath;
+		if ( !sLongLink.empty() )
+			sLink = sLongLink;
+		if ( hasPaxLink )
+			sLink = sPaxLink;
+		if ( hasPaxSize )
+			size = paxSize;
+
+		switch ( h.typeflag ) {
+		case '0':
+		case '\0':
+		case '7':
+			// old archives mark directories with a trailing '/'
+			if ( !sName.empty() && sName.back() == '/' )
+				e.type = 'D';
+			else
+				e.type = ( mode & 0100 ) ? 'X' : 'F';
+			break;
+		case '1':
+			e.type = 'H';
+			sLink = cleanPath( sLink );
+			break;
+		case '2':
+			e.type = 'L';
+			break;
+		case '5':
+			e.type = 'D';
+			break;
+		default:
+			e.type = 0;
+			break;
+		}
+
+		e.path = cleanPath( sName );
+		e.link = sLink;
+		e.size = ( e.type == 'F' || e.type == 'X' ) ? size : 0;
+		m_left = size + tarWriter::padding(size);
+
+		return true;
+	}
+}
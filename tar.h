@@ -0,0 +1,98 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TAR_H_INCLUDED
+#define TAR_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TAR_BLOCK 512
+
+
+// Headers of a tar stream for extract --to-tar. Entries are written as
+// ustar; names and link targets that don't fit and sizes of 8 GiB or
+// more go into pax extended headers.
+class tarWriter {
+
+public:
+	// Append the header block(s) of an entry to s, type is one of 'F', 'X',
+	// 'L' and 'D' like in an entryTable. Its data has to follow, padded.
+	static void header( std::string &s, const std::string &sPath, char type, uint64_t size,
+		const std::string &sLink, int64_t mtime );
+
+	// append the end of the archive, two zero blocks
+	static void end( std::string &s );
+
+	// bytes that pad size bytes of data to full blocks
+	static size_t padding( uint64_t size ) { return (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK; }
+
+};
+
+// Reads the entries of a tar stream (ustar, pax or GNU) from a file
+// descriptor, which may be a pipe. Not thread-safe.
+class tarReader {
+
+public:
+	typedef struct {
+		std::string path;  // relative, without "./" and a trailing '/'
+		std::string link;  // 'L': the target, 'H': path of the earlier entry
+		uint64_t size;     // bytes of data that follow, read them with read()
+		char type;         // 'F', 'X', 'L', 'D', 'H' for a hard link,
+		                   // 0 for anything else
+	} entry_t;
+
+	explicit tarReader( int fd );
+
+	// the next entry, false at the end of the archive or on an error
+	bool next( entry_t &e );
+
+	// size bytes of the data of the current entry
+	bool read( char *buf, size_t size );
+
+	// what went wrong, empty at the end of the archive
+	const std::string &error() const { return m_sError; }
+
+private:
+	int m_fd;
+	std::vector<char> m_vBuf;
+	size_t m_pos = 0;  // unread bytes are [m_pos, m_len) of m_vBuf
+	size_t m_len = 0;
+	uint64_t m_left = 0;  // data of the current entry not read yet, with padding
+	std::string m_sError;
+
+	bool readRaw( char *buf, size_t size );
+	bool skip( uint64_t size );
+	bool fail( const char *msg );
+	bool longValue( uint64_t size, std::string &s );
+
+	static uint64_t number( const char *p, size_t len, bool &ok );
+	static std::string cleanPath( const std::string &s );
+
+};
+
+#endif // TAR_H_INCLUDED
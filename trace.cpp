@@ -0,0 +1,181 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+#include "trace.h"
+
+
+void traceLog::enable( bool bEvents, size_t slowest ) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_vEvents.clear();
+	m_vPhases.clear();
+	m_vSlowest.clear();
+	m_mapThreads.clear();
+	m_bEvents = bEvents;
+	m_slowest = slowest;
+	m_start = std::chrono::steady_clock::now();
+	m_bEnabled = true;
+}
+
+// small numbers for the threads, in order of their first event
+unsigned traceLog::threadIndex() {
+	auto r = m_mapThreads.emplace( std::this_thread::get_id(), m_mapThreads.size() + 1 );
+	return r.first->second;
+}
+
+void traceLog::phase( const char *name, uint64_t start ) {
+	uint64_t end = now();
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = std::find_if( m_vPhases.begin(), m_vPhases.end(), [name] (const phaseTotal_t &p) {
+		return p.name == name;
+	});
+
+	if ( it == m_vPhases.end() ) {
+		phaseTotal_t p = { name, 0, 0 };
+		it = m_vPhases.insert( m_vPhases.end(), p );
+	}
+
+	it->nanos += end - start;
+	it->count++;
+
+	if ( m_bEvents ) {
+		event_t e = { name, std::string(), start, end - start, threadIndex() };
+		m_vEvents.push_back( std::move(e) );
+	}
+}
+
+static bool fasterThan( const traceLog::fileTime_t &a, const traceLog::fileTime_t &b ) {
+	return a.nanos > b.nanos;
+}
+
+void traceLog::file( const char *cat, const std::string &sPath, uint64_t size, uint64_t start ) {
+	uint64_t end = now();
+	uint64_t nanos = end - start;
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if ( m_slowest > 0 && (m_vSlowest.size() < m_slowest || nanos > m_vSlowest.front().nanos) ) {
+		if ( m_vSlowest.size() == m_slowest ) {
+			std::pop_heap( m_vSlowest.begin(), m_vSlowest.end(), fasterThan );
+			m_vSlowest.pop_back();
+		}
+
+		fileTime_t f = { sPath, cat, size, nanos };
+		m_vSlowest.push_back( f );
+		std::push_heap( m_vSlowest.begin(), m_vSlowest.end(), fasterThan );
+	}
+
+	if ( m_bEvents ) {
+		event_t e = { cat, sPath, start, nanos, threadIndex() };
+		m_vEvents.push_back( std::move(e) );
+	}
+}
+
+std::vector<traceLog::phaseTotal_t> traceLog::phases() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_vPhases;
+}
+
+std::vector<traceLog::fileTime_t> traceLog::slowest() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<fileTime_t> v = m_vSlowest;
+
+	std::sort_heap( v.begin(), v.end(), fasterThan );
+	return v;
+}
+
+bool traceLog::writeChrome( const std::string &sPath, const std::vector<std::pair<const char *, uint64_t>> &vCounters ) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	rapidjson::StringBuffer sb;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+	uint64_t end = 0;
+
+	writer.StartObject();
+	writer.Key("traceEvents");
+	writer.StartArray();
+
+	// timestamps are microseconds
+	for ( const auto &e : m_vEvents ) {
+		writer.StartObject();
+		writer.Key("name");
+		if ( e.path.empty() ) {
+			writer.String( e.name );
+			writer.Key("cat");
+			writer.String("phase");
+		} else {
+			writer.String( e.path.data(), e.path.size() );
+			writer.Key("cat");
+			writer.String( e.name );
+		}
+		writer.Key("ph");
+		writer.String("X");
+		writer.Key("ts");
+		writer.Uint64( e.start / 1000 );
+		writer.Key("dur");
+		writer.Uint64( e.dur / 1000 );
+		writer.Key("pid");
+		writer.Uint(1);
+		writer.Key("tid");
+		writer.Uint( e.tid );
+		writer.EndObject();
+
+		end = std::max( end, e.start + e.dur );
+	}
+
+	if ( !vCounters.empty() ) {
+		writer.StartObject();
+		writer.Key("name");
+		writer.String("counters");
+		writer.Key("ph");
+		writer.String("C");
+		writer.Key("ts");
+		writer.Uint64( end / 1000 );
+		writer.Key("pid");
+		writer.Uint(1);
+		writer.Key("args");
+		writer.StartObject();
+		for ( const auto &c : vCounters ) {
+			writer.Key( c.first );
+			writer.Uint64( c.second );
+		}
+		writer.EndObject();
+		writer.EndObject();
+	}
+
+	writer.EndArray();
+	writer.Key("displayTimeUnit");
+	writer.String("ms");
+	writer.EndObject();
+
+	std::ofstream ofs( sPath, std::ios::binary | std::ios::trunc );
+	ofs.write( sb.GetString(), sb.GetSize() );
+	ofs.close();
+
+	return static_cast<bool>(ofs);
+}
@@ -0,0 +1,128 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+
+// Records where pack and extraction spend their time: phases (wall time
+// of a step, may repeat) and files (time to copy one file). Kept are the
+// total per phase and the slowest files, and with bEvents every single
+// phase and file as a Chrome trace event (chrome://tracing, Perfetto).
+// It is disabled by default and then records nothing; callers check
+// enabled() before taking timestamps. All methods are thread-safe.
+class traceLog {
+
+public:
+	typedef struct {
+		std::string name;
+		uint64_t nanos;
+		uint64_t count;
+	} phaseTotal_t;
+
+	typedef struct {
+		std::string path;
+		const char *cat;
+		uint64_t size;
+		uint64_t nanos;
+	} fileTime_t;
+
+	traceLog() {}
+
+	// start recording, previous data is cleared
+	void enable( bool bEvents, size_t slowest = 10 );
+	void disable() { m_bEnabled = false; }
+	bool enabled() const { return m_bEnabled; }
+
+	// nanoseconds since enable()
+	uint64_t now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - m_start ).count();
+	}
+
+	// a phase or a file that began at start (from now()) ended now
+	void phase( const char *name, uint64_t start );
+	void file( const char *cat, const std::string &sPath, uint64_t size, uint64_t start );
+
+	// phase totals in order of their first appearance, slowest files first
+	std::vector<phaseTotal_t> phases() const;
+	std::vector<fileTime_t> slowest() const;
+
+	// write the events in Chrome's trace event format, vCounters are
+	// added as one counter event at the end
+	bool writeChrome( const std::string &sPath, const std::vector<std::pair<const char *, uint64_t>> &vCounters ) const;
+
+private:
+	typedef struct {
+		const char *name;  // phase name or file category
+		std::string path;  // files only
+		uint64_t start;
+		uint64_t dur;
+		unsigned tid;
+	} event_t;
+
+	bool m_bEnabled = false;
+	bool m_bEvents = false;
+	size_t m_slowest = 0;
+	std::chrono::steady_clock::time_point m_start;
+
+	mutable std::mutex m_mutex;
+	std::vector<event_t> m_vEvents;
+	std::vector<phaseTotal_t> m_vPhases;
+	std::vector<fileTime_t> m_vSlowest;  // min-heap by nanos
+	std::unordered_map<std::thread::id, unsigned> m_mapThreads;
+
+	unsigned threadIndex();
+
+};
+
+// Times a phase from construction to destruction
+class traceScope {
+
+public:
+	traceScope( traceLog &log, const char *name ) :
+		m_log(log), m_name(name), m_start( log.enabled() ? log.now() : 0 ) {}
+
+	~traceScope() {
+		if ( m_log.enabled() )
+			m_log.phase( m_name, m_start );
+	}
+
+private:
+	traceLog &m_log;
+	const char *m_name;
+	uint64_t m_start;
+
+};
+
+#endif // TRACE_H_INCLUDED
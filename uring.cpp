@@ -0,0 +1,234 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+#include "uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+# endif
+#endif
+
+// sqe->file_index came with Linux 5.15, IOSQE_CQE_SKIP_SUCCESS (5.17)
+// is the oldest macro of the header that implies it
+#ifdef IOSQE_CQE_SKIP_SUCCESS
+# define HAVE_IO_URING
+# include <errno.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+
+#ifdef HAVE_IO_URING
+
+uringQueue::~uringQueue() {
+	if ( m_pSqes )
+		munmap( m_pSqes, m_sqesSize );
+	if ( m_pCqRing && m_pCqRing != m_pSqRing )
+		munmap( m_pCqRing, m_cqRingSize );
+	if ( m_pSqRing )
+		munmap( m_pSqRing, m_sqRingSize );
+	if ( m_fd != -1 )
+		::close( m_fd );
+}
+
+static void *mapRing( int fd, size_t size, off_t offset ) {
+	void *p = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset );
+	return (p == MAP_FAILED) ? NULL : p;
+}
+
+bool uringQueue::init( unsigned entries, unsigned fileSlots ) {
+	struct io_uring_params p;
+	memset( &p, 0, sizeof(p) );
+
+	m_fd = ::syscall( __NR_io_uring_setup, entries, &p );
+	if ( m_fd < 0 ) {
+		m_fd = -1;
+		return false;
+	}
+
+	m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		m_sqRingSize = m_cqRingSize = std::max( m_sqRingSize, m_cqRingSize );
+		m_pSqRing = m_pCqRing = mapRing( m_fd, m_sqRingSize, IORING_OFF_SQ_RING );
+	} else {
+		m_pSqRing = mapRing( m_fd, m_sqRingSize, IORING_OFF_SQ_RING );
+		m_pCqRing = mapRing( m_fd, m_cqRingSize, IORING_OFF_CQ_RING );
+	}
+
+	m_sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+	m_pSqes = static_cast<struct io_uring_sqe *>( mapRing( m_fd, m_sqesSize, IORING_OFF_SQES ) );
+
+	if ( !m_pSqRing || !m_pCqRing || !m_pSqes )
+		return false;
+
+	char *sq = static_cast<char *>( m_pSqRing );
+	char *cq = static_cast<char *>( m_pCqRing );
+
+	m_pSqHead = reinterpret_cast<unsigned *>( sq + p.sq_off.head );
+	m_pSqTail = reinterpret_cast<unsigned *>( sq + p.sq_off.tail );
+	m_pSqArray = reinterpret_cast<unsigned *>( sq + p.sq_off.array );
+	m_sqMask = *reinterpret_cast<unsigned *>( sq + p.sq_off.ring_mask );
+	m_sqEntries = p.sq_entries;
+	m_sqTail = *m_pSqTail;
+
+	m_pCqHead = reinterpret_cast<unsigned *>( cq + p.cq_off.head );
+	m_pCqTail = reinterpret_cast<unsigned *>( cq + p.cq_off.tail );
+	m_cqMask = *reinterpret_cast<unsigned *>( cq + p.cq_off.ring_mask );
+	m_pCqes = cq + p.cq_off.cqes;
+
+	// openat() into a direct descriptor came with symlinkat(), in 5.15
+	static const uint8_t ops[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_SYMLINKAT };
+	std::vector<char> vProbe( sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op) );
+	struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>( vProbe.data() );
+
+	if ( ::syscall( __NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, 256 ) != 0 )
+		return false;
+
+	for ( uint8_t op : ops ) {
+		if ( op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED) )
+			return false;
+	}
+
+	// all slots empty
+	std::vector<int> vFiles( fileSlots, -1 );
+
+	return ::syscall( __NR_io_uring_register, m_fd, IORING_REGISTER_FILES, vFiles.data(), fileSlots ) == 0;
+}
+
+unsigned uringQueue::space() const {
+	return m_sqEntries - (m_sqTail - __atomic_load_n( m_pSqHead, __ATOMIC_ACQUIRE ));
+}
+
+struct io_uring_sqe *uringQueue::next( uint8_t opcode, uint64_t data, link_t link ) {
+	unsigned index = m_sqTail & m_sqMask;
+	struct io_uring_sqe *sqe = &m_pSqes[index];
+
+	memset( sqe, 0, sizeof(*sqe) );
+	sqe->opcode = opcode;
+	sqe->user_data = data;
+	if ( link == LINK_SUCCESS )
+		sqe->flags = IOSQE_IO_LINK;
+	else if ( link == LINK_ALWAYS )
+		sqe->flags = IOSQE_IO_HARDLINK;
+
+	m_pSqArray[index] = index;
+	m_sqTail++;
+	m_toSubmit++;
+
+	return sqe;
+}
+
+void uringQueue::openat( int dirfd, const char *path, int flags, unsigned mode, unsigned slot, uint64_t data, link_t link ) {
+	struct io_uring_sqe *sqe = next( IORING_OP_OPENAT, data, link );
+
+	sqe->fd = dirfd;
+	sqe->addr = reinterpret_cast<uintptr_t>( path );
+	sqe->len = mode;
+	sqe->open_flags = flags;  // O_CLOEXEC is refused, direct descriptors aren't inherited anyway
+	sqe->file_index = slot + 1;  // 0 would be a normal descriptor
+}
+
+void uringQueue::write( unsigned slot, const void *buf, uint32_t size, uint64_t offset, uint64_t data, link_t link ) {
+	struct io_uring_sqe *sqe = next( IORING_OP_WRITE, data, link );
+
+	sqe->flags |= IOSQE_FIXED_FILE;
+	sqe->fd = slot;
+	sqe->addr = reinterpret_cast<uintptr_t>( buf );
+	sqe->len = size;
+	sqe->off = offset;
+}
+
+void uringQueue::close( unsigned slot, uint64_t data ) {
+	struct io_uring_sqe *sqe = next( IORING_OP_CLOSE, data, LINK_NONE );
+
+	sqe->file_index = slot + 1;
+}
+
+void uringQueue::symlinkat( const char *target, int dirfd, const char *path, uint64_t data ) {
+	struct io_uring_sqe *sqe = next( IORING_OP_SYMLINKAT, data, LINK_NONE );
+
+	sqe->fd = dirfd;
+	sqe->addr = reinterpret_cast<uintptr_t>( target );
+	sqe->addr2 = reinterpret_cast<uintptr_t>( path );
+}
+
+bool uringQueue::submit( unsigned wait ) {
+	__atomic_store_n( m_pSqTail, m_sqTail, __ATOMIC_RELEASE );
+
+	while ( m_toSubmit > 0 || wait > 0 ) {
+		int n = ::syscall( __NR_io_uring_enter, m_fd, m_toSubmit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+
+		if ( n < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			return false;
+		}
+
+		// the kernel stops at an operation it cannot even start,
+		// that one completes with an error and the rest follow
+		if ( n == 0 && m_toSubmit > 0 )
+			return false;
+
+		m_toSubmit -= n;
+		wait = 0;
+	}
+
+	return true;
+}
+
+bool uringQueue::complete( uint64_t &data, int &res ) {
+	unsigned head = *m_pCqHead;
+
+	if ( head == __atomic_load_n( m_pCqTail, __ATOMIC_ACQUIRE ) )
+		return false;
+
+	const struct io_uring_cqe *cqe = static_cast<const struct io_uring_cqe *>( m_pCqes ) + (head & m_cqMask);
+	data = cqe->user_data;
+	res = cqe->res;
+
+	__atomic_store_n( m_pCqHead, head + 1, __ATOMIC_RELEASE );
+	return true;
+}
+
+#else  // HAVE_IO_URING
+
+uringQueue::~uringQueue() {}
+bool uringQueue::init( unsigned, unsigned ) { return false; }
+unsigned uringQueue::space() const { return 0; }
+void uringQueue::openat( int, const char *, int, unsigned, unsigned, uint64_t, link_t ) {}
+void uringQueue::write( unsigned, const void *, uint32_t, uint64_t, uint64_t, link_t ) {}
+void uringQueue::close( unsigned, uint64_t ) {}
+void uringQueue::symlinkat( const char *, int, const char *, uint64_t ) {}
+bool uringQueue::submit( unsigned ) { return false; }
+bool uringQueue::complete( uint64_t &, int & ) { return false; }
+
+#endif  // HAVE_IO_URING
@@ -0,0 +1,102 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef URING_H_INCLUDED
+#define URING_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct io_uring_sqe;
+
+
+// One io_uring instance driven through the raw system calls (no liburing),
+// wrapping only what extraction needs. The ring has a table of direct
+// descriptors ("fixed files"): openat() opens into one of its slots and
+// the following write() and close() refer to the slot, so the three can
+// be linked into a chain and submitted together without the file ever
+// getting a normal descriptor. Not thread-safe.
+class uringQueue {
+
+public:
+	// how an operation is linked to the next one queued
+	enum link_t {
+		LINK_NONE = 0,  // independent
+		LINK_SUCCESS,   // the next one runs after this one succeeded, else it is cancelled
+		LINK_ALWAYS     // the next one runs after this one, even if it failed
+	};
+
+	uringQueue() {}
+	~uringQueue();
+
+	// Set up a ring for up to entries queued operations and with fileSlots
+	// direct descriptors. False if io_uring is not available: not Linux,
+	// disabled by the administrator or a kernel older than 5.15.
+	bool init( unsigned entries, unsigned fileSlots );
+
+	// number of operations that can be queued before submit()
+	unsigned space() const;
+
+	// Queue operations, data is returned with their completion.
+	// Pointers must stay valid until that completion.
+	void openat( int dirfd, const char *path, int flags, unsigned mode, unsigned slot, uint64_t data, link_t link );
+	void write( unsigned slot, const void *buf, uint32_t size, uint64_t offset, uint64_t data, link_t link );
+	void close( unsigned slot, uint64_t data );
+	void symlinkat( const char *target, int dirfd, const char *path, uint64_t data );
+
+	// submit the queued operations and wait for at least wait completions
+	bool submit( unsigned wait );
+
+	// take the next completion, res is the result of the system call
+	// (-errno on error), false if there is none
+	bool complete( uint64_t &data, int &res );
+
+private:
+	int m_fd = -1;
+	void *m_pSqRing = NULL;
+	void *m_pCqRing = NULL;
+	size_t m_sqRingSize = 0;
+	size_t m_cqRingSize = 0;
+	struct io_uring_sqe *m_pSqes = NULL;
+	size_t m_sqesSize = 0;
+
+	unsigned *m_pSqHead = NULL;
+	unsigned *m_pSqTail = NULL;
+	unsigned *m_pSqArray = NULL;
+	unsigned m_sqMask = 0;
+	unsigned m_sqEntries = 0;
+	unsigned m_sqTail = 0;     // local tail, published by submit()
+	unsigned m_toSubmit = 0;
+
+	unsigned *m_pCqHead = NULL;
+	unsigned *m_pCqTail = NULL;
+	unsigned m_cqMask = 0;
+	const void *m_pCqes = NULL;
+
+	struct io_uring_sqe *next( uint8_t opcode, uint64_t data, link_t link );
+
+};
+
+#endif // URING_H_INCLUDED
@@ -0,0 +1,120 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <thread>
+#include "workpool.h"
+
+
+workPool::workPool( unsigned workers ) : m_pending(0), m_queued(0), m_idle(0) {
+	if ( workers == 0 )
+		workers = 1;
+
+	for ( unsigned i = 0; i < workers; i++ )
+		m_queues.emplace_back( new queue_t );
+}
+
+void workPool::push( unsigned worker, task_t task ) {
+	queue_t &q = *m_queues[worker % m_queues.size()];
+
+	m_pending++;
+	{
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.tasks.push_back( std::move(task) );
+		m_queued++;
+	}
+
+	// a worker that is about to wait sees m_queued, or we see it in m_idle
+	if ( m_idle > 0 ) {
+		std::lock_guard<std::mutex> lock(m_idleMutex);
+		m_wakeup.notify_one();
+	}
+}
+
+bool workPool::pop( unsigned worker, task_t &task ) {
+	// own queue first, newest task
+	{
+		queue_t &q = *m_queues[worker];
+		std::lock_guard<std::mutex> lock(q.mutex);
+
+		if ( !q.tasks.empty() ) {
+			task = std::move( q.tasks.back() );
+			q.tasks.pop_back();
+			m_queued--;
+			return true;
+		}
+	}
+
+	// steal the oldest task of another worker
+	for ( size_t i = 1; i < m_queues.size(); i++ ) {
+		queue_t &q = *m_queues[(worker + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(q.mutex);
+
+		if ( !q.tasks.empty() ) {
+			task = std::move( q.tasks.front() );
+			q.tasks.pop_front();
+			m_queued--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void workPool::work( unsigned worker ) {
+	task_t task;
+
+	// m_pending only drops to zero once the last task has finished,
+	// so a task still running may push more work for us to steal
+	while ( m_pending > 0 ) {
+		if ( pop(worker, task) ) {
+			task(worker);
+			task = nullptr;
+
+			if ( --m_pending == 0 ) {
+				std::lock_guard<std::mutex> lock(m_idleMutex);
+				m_wakeup.notify_all();
+			}
+		} else {
+			// sleep instead of spinning while the running tasks, e.g. one
+			// blocked in getdents, have pushed nothing to steal
+			std::unique_lock<std::mutex> lock(m_idleMutex);
+			m_idle++;
+			m_wakeup.wait( lock, [this] { return m_pending == 0 || m_queued > 0; } );
+			m_idle--;
+		}
+	}
+}
+
+void workPool::run() {
+	std::vector<std::thread> vThreads;
+
+	for ( unsigned i = 1; i < m_queues.size(); i++ )
+		vThreads.emplace_back( &workPool::work, this, i );
+
+	work(0);
+
+	for ( auto &t : vThreads )
+		t.join();
+}
@@ -0,0 +1,77 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 Maks-s
+ * Copyright (c) 2022 djcj <djcj@gmx.de>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WORKPOOL_H_INCLUDED
+#define WORKPOOL_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// Small work-stealing thread pool for tasks that spawn more tasks, like
+// a directory walk. Every worker owns a deque: it pushes and pops new
+// work at the back (depth first) and steals from the front of the other
+// workers' deques when its own runs dry, and sleeps while there is
+// nothing to steal.
+class workPool {
+
+public:
+	typedef std::function<void(unsigned worker)> task_t;
+
+	explicit workPool( unsigned workers );
+
+	unsigned size() const { return m_queues.size(); }
+
+	// queue a task, worker is the index of the calling worker
+	// (any index is fine before run())
+	void push( unsigned worker, task_t task );
+
+	// run until all tasks, including those pushed by tasks, are done
+	void run();
+
+private:
+	typedef struct {
+		std::mutex mutex;
+		std::deque<task_t> tasks;
+	} queue_t;
+
+	std::vector<std::unique_ptr<queue_t>> m_queues;
+	std::atomic<size_t> m_pending;  // queued or running tasks
+	std::atomic<size_t> m_queued;   // queued tasks
+	std::atomic<unsigned> m_idle;   // workers waiting for m_wakeup
+	std::mutex m_idleMutex;
+	std::condition_variable m_wakeup;
+
+	bool pop( unsigned worker, task_t &task );
+	void work( unsigned worker );
+
+};
+
+#endif // WORKPOOL_H_INCLUDED